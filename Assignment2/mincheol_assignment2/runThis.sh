@@ -16,3 +16,24 @@ do
 		./test_threads_fine $THREAD >> results/fine_$THREAD
 	done
 done
+
+# read-mostly: 90% balance reads, seqlock vs mutex, single and 8-account snapshots
+for ITER in `seq 1 100`
+do
+	for THREAD in 1 2 4
+	do
+		./test_threads_fine -r 90 $THREAD >> results/fine_read_$THREAD
+		./test_threads_fine -r 90 -l $THREAD >> results/fine_read_locked_$THREAD
+		./test_threads_fine -r 90 -s 8 $THREAD >> results/fine_snap_$THREAD
+		./test_threads_fine -r 90 -s 8 -l $THREAD >> results/fine_snap_locked_$THREAD
+	done
+done
+
+# 48-byte records vs one record per line (make padded)
+for ITER in `seq 1 100`
+do
+	for THREAD in 1 2 4
+	do
+		./test_threads_fine_padded $THREAD >> results/fine_padded_$THREAD
+	done
+done
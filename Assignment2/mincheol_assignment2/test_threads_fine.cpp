@@ -8,16 +8,31 @@
 #include <sys/sem.h>
 #include <unistd.h>
 #include <errno.h>
+#include <getopt.h>
 
 #define CFENCE  __asm__ volatile ("":::"memory")
 #define MFENCE  __asm__ volatile ("mfence":::"memory")
 
+#define MAX_SNAPSHOT 64
+
+/* seq is odd while a writer holding lock is changing balance. A record
+   is 48 bytes, so most straddle two lines; -DACCOUNT_PADDED gives each
+   one its own line. */
 struct account {
-	unsigned balance;
+	volatile unsigned balance;
+	volatile unsigned seq;
 	pthread_mutex_t lock;
-};
+}
+#ifdef ACCOUNT_PADDED
+__attribute__((aligned(64)))
+#endif
+;
 struct account accounts[1000000];
 
+int read_pct = 0;		/* % of operations that only read */
+int snapshot_size = 1;		/* accounts per read */
+bool locked_reads = false;	/* take the mutexes instead of the seqlock */
+
 struct arg_struct {
 	int ids;
 	int num_transfer;
@@ -52,6 +67,95 @@ signal_callback_handler(int signum)
    exit(signum);
 }
 
+/* Called with the account's lock held */
+inline void write_begin(struct account *a)
+{
+	a->seq = a->seq + 1;
+	CFENCE;
+}
+
+inline void write_end(struct account *a)
+{
+	CFENCE;
+	a->seq = a->seq + 1;
+}
+
+/* Optimistic read: retry while a writer is inside or got in meanwhile.
+   x86 keeps loads in order, so compiler fences are enough. */
+inline unsigned read_balance(int i)
+{
+	unsigned seq, balance;
+
+	for (;;) {
+		seq = accounts[i].seq;
+		if (seq & 1) {
+			__builtin_ia32_pause();
+			continue;
+		}
+		CFENCE;
+		balance = accounts[i].balance;
+		CFENCE;
+		if (accounts[i].seq == seq)
+			return balance;
+	}
+}
+
+inline unsigned read_balance_locked(int i)
+{
+	unsigned balance;
+
+	pthread_mutex_lock(&accounts[i].lock);
+	balance = accounts[i].balance;
+	pthread_mutex_unlock(&accounts[i].lock);
+	return balance;
+}
+
+/* Balances of ids[0..n) as they all were at one instant: no sequence
+   number may move between the first and the second pass. */
+inline void snapshot(const int *ids, int n, unsigned *out)
+{
+	unsigned seqs[MAX_SNAPSHOT];
+	int i;
+
+retry:
+	for (i = 0; i < n; i++) {
+		seqs[i] = accounts[ids[i]].seq;
+		if (seqs[i] & 1) {
+			__builtin_ia32_pause();
+			goto retry;
+		}
+	}
+	CFENCE;
+	for (i = 0; i < n; i++)
+		out[i] = accounts[ids[i]].balance;
+	CFENCE;
+	for (i = 0; i < n; i++)
+		if (accounts[ids[i]].seq != seqs[i])
+			goto retry;
+}
+
+/* The same with every lock held, taken in index order */
+inline void snapshot_locked(const int *ids, int n, unsigned *out)
+{
+	int sorted[MAX_SNAPSHOT];
+	int i, j;
+
+	for (i = 0; i < n; i++) {
+		int id = ids[i];
+		for (j = i; j > 0 && sorted[j-1] > id; j--)
+			sorted[j] = sorted[j-1];
+		sorted[j] = id;
+	}
+	for (i = 0; i < n; i++)
+		if (i == 0 || sorted[i] != sorted[i-1])
+			pthread_mutex_lock(&accounts[sorted[i]].lock);
+	for (i = 0; i < n; i++)
+		out[i] = accounts[ids[i]].balance;
+	for (i = n - 1; i >= 0; i--)
+		if (i == 0 || sorted[i] != sorted[i-1])
+			pthread_mutex_unlock(&accounts[sorted[i]].lock);
+}
+
 volatile bool ExperimentInProgress = true;
 static void catch_SIGALRM(int sig_num)
 {
@@ -64,10 +168,30 @@ void* th_run(void * args)
 	int id = this_args.ids;
 	int num_transfer = this_args.num_transfer;
 	unsigned long long sender = 0, receiver = 0;
+	unsigned long long read_sum = 0;
 	
 	barrier(0);
 
 	for (int i=0; i<num_transfer; i++) {
+		if (read_pct && (int)(get_real_time()%100) < read_pct) {
+			int ids[MAX_SNAPSHOT];
+			unsigned balances[MAX_SNAPSHOT];
+
+			for (int j = 0; j < snapshot_size; j++)
+				ids[j] = (get_real_time() + j * 7919)%1000000;
+
+			if (snapshot_size == 1)
+				balances[0] = locked_reads ? read_balance_locked(ids[0]) : read_balance(ids[0]);
+			else if (locked_reads)
+				snapshot_locked(ids, snapshot_size, balances);
+			else
+				snapshot(ids, snapshot_size, balances);
+
+			for (int j = 0; j < snapshot_size; j++)
+				read_sum += balances[j];
+			continue;
+		}
+
 		sender = get_real_time()%1000000;
 		
 		pthread_mutex_lock(&accounts[sender].lock);
@@ -77,7 +201,9 @@ void* th_run(void * args)
 			continue;
 		}
 
+		write_begin(&accounts[sender]);
 		accounts[sender].balance = accounts[sender].balance - 50;
+		write_end(&accounts[sender]);
 		pthread_mutex_unlock(&accounts[sender].lock);
 
 		do {
@@ -85,9 +211,15 @@ void* th_run(void * args)
 		} while (sender == receiver);	
 		
 		pthread_mutex_lock(&accounts[receiver].lock);
+		write_begin(&accounts[receiver]);
 		accounts[receiver].balance = accounts[receiver].balance + 50;
+		write_end(&accounts[receiver]);
 		pthread_mutex_unlock(&accounts[receiver].lock);
 	}
+
+	/* keep the reads from being optimized away */
+	if (read_sum == 1)
+		printf("read sum %llu\n", read_sum);
 	return 0;
 }
 
@@ -95,17 +227,36 @@ int main(int argc, char* argv[])
 {
 //	signal(SIGINT, signal_callback_handler);
 
-	if (argc < 2) {
-		printf("Usage test threads#\n");
+	int opt;
+	while ((opt = getopt(argc, argv, "r:s:l")) != -1) {
+		switch (opt) {
+		case 'r':
+			read_pct = atoi(optarg);
+			break;
+		case 's':
+			snapshot_size = atoi(optarg);
+			break;
+		case 'l':
+			locked_reads = true;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind >= argc || snapshot_size < 1 || snapshot_size > MAX_SNAPSHOT) {
+		printf("Usage test [-r read %%] [-s snapshot accounts] [-l] threads#\n");
 		exit(0);
 	}
 
-    total_threads = atoi(argv[1]);
+    total_threads = atoi(argv[optind]);
 
 	// initialize accounts
 	for (int i = 0; i < 1000000; i++)
 	{ 
 		accounts[i].balance = 1000;
+		accounts[i].seq = 0;
 		if (pthread_mutex_init(&(accounts[i].lock), NULL) != 0)
     	{
        		printf("\n mutex init failed\n");
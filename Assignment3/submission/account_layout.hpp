@@ -0,0 +1,79 @@
+#ifndef ACCOUNT_LAYOUT_HPP
+#define ACCOUNT_LAYOUT_HPP 1
+
+#include <pthread.h>
+#include <atomic>
+
+/**
+ *  Where an account's balance and its lock live, as in Assignment4's
+ *  account_layout.hpp. Pick one with -DACCOUNT_LAYOUT=<n>:
+ *
+ *    LAYOUT_SPLIT   0  two arrays, balances and locks (the default). Every
+ *                      access touches two lines.
+ *    LAYOUT_PACKED  1  balance, version and mutex in one 48-byte record.
+ *                      Fewer misses, but records straddle lines.
+ *    LAYOUT_PADDED  2  one record per 64-byte line. One miss and no false
+ *                      sharing.
+ *
+ *  The STM only goes through value(i) and lock(i), so the layout does not
+ *  change the algorithm.
+ */
+
+#define LAYOUT_SPLIT	0
+#define LAYOUT_PACKED	1
+#define LAYOUT_PADDED	2
+
+#ifndef ACCOUNT_LAYOUT
+#define ACCOUNT_LAYOUT LAYOUT_SPLIT
+#endif
+
+struct lock_table {
+	std::atomic<unsigned int> version;		/* read unlocked by validation */
+	pthread_mutex_t lock;
+};
+
+template<int Layout, int N>
+struct account_table;
+
+template<int N>
+struct account_table<LAYOUT_SPLIT, N>
+{
+	unsigned int values[N];
+	struct lock_table locks[N];
+
+	unsigned int& value(unsigned int i) { return values[i]; }
+	struct lock_table& lock(unsigned int i) { return locks[i]; }
+	static const char *name() { return "split"; }
+};
+
+template<int N>
+struct account_table<LAYOUT_PACKED, N>
+{
+	struct record
+	{
+		unsigned int value;
+		struct lock_table lock;
+	};
+	record records[N];
+
+	unsigned int& value(unsigned int i) { return records[i].value; }
+	struct lock_table& lock(unsigned int i) { return records[i].lock; }
+	static const char *name() { return "packed"; }
+};
+
+template<int N>
+struct account_table<LAYOUT_PADDED, N>
+{
+	struct alignas(64) record
+	{
+		unsigned int value;
+		struct lock_table lock;
+	};
+	record records[N];
+
+	unsigned int& value(unsigned int i) { return records[i].value; }
+	struct lock_table& lock(unsigned int i) { return records[i].lock; }
+	static const char *name() { return "padded"; }
+};
+
+#endif //ACCOUNT_LAYOUT_HPP
@@ -9,9 +9,8 @@
 #include <unistd.h>
 
 #include <errno.h>
-
-#define CFENCE  __asm__ volatile ("":::"memory")
-#define MFENCE  __asm__ volatile ("mfence":::"memory")
+#include <atomic>
+#include "account_layout.hpp"
 
 #define RS_SCALE (1.0 / (1.0 + RAND_MAX))
 #define NUM_OF_ACCOUNTS 1000000
@@ -34,13 +33,7 @@ struct read_set {
 	unsigned int version;
 };
 
-struct lock_table {
-	unsigned int version;
-	pthread_mutex_t lock;
-};
-
-unsigned int accounts[NUM_OF_ACCOUNTS];
-struct lock_table locks[NUM_OF_ACCOUNTS];
+account_table<ACCOUNT_LAYOUT, NUM_OF_ACCOUNTS> table;
 
 int total_threads;
 int	num_transfer;
@@ -59,11 +52,9 @@ inline unsigned long long get_real_time() {
 void
 barrier(int which)
 {
-    static volatile int barriers[16] = {0};
-    CFENCE;
-    __sync_fetch_and_add(&barriers[which], 1);
-    while (barriers[which] != total_threads) { }
-    CFENCE;
+    static std::atomic<int> barriers[16];
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    while (barriers[which].load(std::memory_order_acquire) != total_threads) { }
 }
 
 void
@@ -73,10 +64,10 @@ signal_callback_handler(int signum)
    exit(signum);
 }
 
-volatile bool ExperimentInProgress = true;
+std::atomic<bool> ExperimentInProgress(true);
 static void catch_SIGALRM(int sig_num)
 {
-    ExperimentInProgress = false;
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
 }
 
 void tx_begin(struct write_set *ws, struct read_set *rs)
@@ -99,12 +90,12 @@ int tx_commit(struct write_set *ws, struct read_set *rs)
 		if (ws[i].valid == 1)
 		{
 			/* if failed to lock */
-			if (pthread_mutex_trylock(&(locks[ws[i].addr].lock)) == EBUSY)
+			if (pthread_mutex_trylock(&(table.lock(ws[i].addr).lock)) == EBUSY)
 			{
 				for (int j = 0; j < i; j++)
 				{
 					if (ws[j].valid == 1)
-						pthread_mutex_unlock(&(locks[ws[j].addr].lock));
+						pthread_mutex_unlock(&(table.lock(ws[j].addr).lock));
 				}
 				
 				/* abort */
@@ -117,14 +108,14 @@ int tx_commit(struct write_set *ws, struct read_set *rs)
 	{
 		if (rs[i].valid == 1)
 		{
-			if (rs[i].version != locks[rs[i].addr].version)
+			if (rs[i].version != table.lock(rs[i].addr).version.load(std::memory_order_acquire))
 			{			
 				for (int j = 0; j < SIZE_OF_SET; j++)
 				{
 					/* unlock the wirte-set's lock */
 					if(ws[j].valid == 1)
 					{
-						pthread_mutex_unlock(&(locks[ws[j].addr].lock));
+						pthread_mutex_unlock(&(table.lock(ws[j].addr).lock));
 					}
 				}
 				/* abort */
@@ -138,9 +129,11 @@ int tx_commit(struct write_set *ws, struct read_set *rs)
 		if (ws[i].valid == 1)
 		{
 			/* write back */
-			accounts[ws[i].addr] = ws[i].value;
-			locks[ws[i].addr].version++;
-			pthread_mutex_unlock(&(locks[ws[i].addr].lock));
+			/* the mutex serializes writers; the store publishes to validators */
+			table.value(ws[i].addr) = ws[i].value;
+			unsigned int version = table.lock(ws[i].addr).version.load(std::memory_order_relaxed);
+			table.lock(ws[i].addr).version.store(version + 1, std::memory_order_release);
+			pthread_mutex_unlock(&(table.lock(ws[i].addr).lock));
 		}
 	}
 
@@ -156,7 +149,7 @@ unsigned int tx_read(struct write_set *ws, struct read_set *rs, unsigned int add
 			return ws[i].value;
 	}
 
-	if ( pthread_mutex_trylock(&(locks[addr].lock)) == EBUSY )
+	if ( pthread_mutex_trylock(&(table.lock(addr).lock)) == EBUSY )
 	{	
 		*err = 1;
 		return 0;
@@ -169,9 +162,9 @@ unsigned int tx_read(struct write_set *ws, struct read_set *rs, unsigned int add
 			{
 				rs[j].valid = 1;
 				rs[j].addr = addr;
-				rs[j].version = locks[addr].version;				
-				value = accounts[addr];
-				pthread_mutex_unlock(&locks[addr].lock);
+				rs[j].version = table.lock(addr).version.load(std::memory_order_relaxed);
+				value = table.value(addr);
+				pthread_mutex_unlock(&table.lock(addr).lock);
 				return value;
 			}
 		}
@@ -268,9 +261,9 @@ int main(int argc, char* argv[])
 	// initialize accounts
 	for (int i = 0; i < NUM_OF_ACCOUNTS; i++)
 	{ 
-		accounts[i] = 1000;
-		locks[i].version = 0;
-		if (pthread_mutex_init(&locks[i].lock, NULL) != 0)
+		table.value(i) = 1000;
+		table.lock(i).version.store(0, std::memory_order_relaxed);
+		if (pthread_mutex_init(&table.lock(i).lock, NULL) != 0)
     	{
      		printf("\n mutex init failed\n");
        		return 1;
@@ -290,10 +283,10 @@ int main(int argc, char* argv[])
 	}
 	
 	// Verification
-	volatile unsigned int total_balance = 0;
+	unsigned int total_balance = 0;
 	for (int j = 0; j < NUM_OF_ACCOUNTS; j++)
 	{
-		total_balance = total_balance + accounts[j];
+		total_balance = total_balance + table.value(j);
 	}
 	printf("Before: total balance = %u\n", total_balance);
 	
@@ -304,13 +297,13 @@ int main(int argc, char* argv[])
 		pthread_join(client_th[i], NULL);
 	}
 	
-	printf("Time: %lld\n", get_real_time() - start);
+	printf("Time: %lld (%s layout)\n", get_real_time() - start, table.name());
 	
 	// Verification
 	total_balance = 0;
 	for (int j = 0; j < NUM_OF_ACCOUNTS; j++)
 	{
-		total_balance = total_balance + accounts[j];
+		total_balance = total_balance + table.value(j);
 	}
 
 	printf("After: total balance = %u\n", total_balance);
@@ -318,7 +311,7 @@ int main(int argc, char* argv[])
 	
 	for (int i = 0; i < NUM_OF_ACCOUNTS; i++)
 	{
-		pthread_mutex_destroy(&locks[i].lock);
+		pthread_mutex_destroy(&table.lock(i).lock);
 	}
 
 	return 0;
@@ -18,3 +18,20 @@ do
 		./stm_1000_disjoint $THREAD >> results/1000_disjoint_$THREAD
 	done
 done
+
+# account layouts (make layouts); cache misses too when perf is around
+PERF=""
+command -v perf >/dev/null 2>&1 && PERF="perf stat -e cache-misses,cache-references -o /dev/stdout"
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4
+	do
+		for LAYOUT in packed padded
+		do
+			$PERF ./stm_1000000_$LAYOUT $THREAD >> results/1000000_${LAYOUT}_$THREAD
+			$PERF ./stm_1000_$LAYOUT $THREAD >> results/1000_${LAYOUT}_$THREAD
+		done
+		$PERF ./stm_1000000 $THREAD >> results/1000000_split_$THREAD
+		$PERF ./stm_1000 $THREAD >> results/1000_split_$THREAD
+	done
+done
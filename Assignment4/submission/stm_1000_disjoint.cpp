@@ -8,27 +8,25 @@
 #include <sys/sem.h>
 #include <unistd.h>
 #include <errno.h>
+#include <atomic>
 #include "rand_r_32.h"
+#include "account_layout.hpp"
 
-#define CFENCE  __asm__ volatile ("":::"memory")
-#define MFENCE  __asm__ volatile ("mfence":::"memory")
+/* versioned locks: version << 1 | locked */
+#define IS_LOCKED(lock) ((lock).load(std::memory_order_acquire) & 1)
 
-#define IS_LOCKED(lock) lock & 1 == 1
+#define UNLOCK(lock, new_ver) (lock).store((new_ver) << 1, std::memory_order_release)
 
-#define UNLOCK(lock, new_ver) lock = new_ver << 1
+#define GET_VERSION(lock) ((lock).load(std::memory_order_acquire) >> 1)
 
-#define GET_VERSION(lock) lock >> 1
-
-#define IS_UNCHANGED(old_lock_val, lock)  (old_lock_val & ~1) == lock
-
-#define TRY_LOCK(lock) __sync_bool_compare_and_swap(&(lock), (lock) & ~1, lock | 1)
+#define TRY_LOCK(lock) try_lock(lock)
 
 #define DISJOINT
 #define NUM_OF_ACCOUNTS 1000
 #define NUM_OF_TRANSFER 100000
 #define SIZE_OF_SET 20
 
-volatile unsigned int global_clock;
+std::atomic<unsigned int> global_clock;
 
 struct arg_struct {
 	int ids;
@@ -46,8 +44,7 @@ struct read_set {
 	unsigned int  addr;
 };
 
-volatile unsigned int accounts[NUM_OF_ACCOUNTS];
-volatile unsigned int locks[NUM_OF_ACCOUNTS];
+account_table<ACCOUNT_LAYOUT, NUM_OF_ACCOUNTS> table;
 int accounts_allowed;
 
 int total_threads;
@@ -67,11 +64,17 @@ inline unsigned long long get_real_time() {
 void
 barrier(int which)
 {
-    static volatile int barriers[16] = {0};
-   	CFENCE;
-    __sync_fetch_and_add(&barriers[which], 1);
-    while (barriers[which] != total_threads) { }
-    CFENCE;
+    static std::atomic<int> barriers[16];
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    while (barriers[which].load(std::memory_order_acquire) != total_threads) { }
+}
+
+inline bool try_lock(std::atomic<unsigned int>& lock)
+{
+	unsigned int unlocked = lock.load(std::memory_order_relaxed) & ~1u;
+
+	return lock.compare_exchange_strong(unlocked, unlocked | 1,
+			std::memory_order_acquire, std::memory_order_relaxed);
 }
 
 void
@@ -81,10 +84,10 @@ signal_callback_handler(int signum)
    exit(signum);
 }
 
-volatile bool ExperimentInProgress = true;
+std::atomic<bool> ExperimentInProgress(true);
 static void catch_SIGALRM(int sig_num)
 {
-    ExperimentInProgress = false;
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
 }
 
 void tx_begin(struct write_set *ws, struct read_set *rs, unsigned int *rv)
@@ -97,27 +100,29 @@ void tx_begin(struct write_set *ws, struct read_set *rs, unsigned int *rv)
 		rs[i].valid = 0;
 		rs[i].addr = 0;
 	}
-	*rv = global_clock; 
+	*rv = global_clock.load(std::memory_order_acquire);
 }
 
 int tx_commit(struct write_set *ws, struct read_set *rs, unsigned int rv)
 {
 	unsigned int wv = 0;
-	volatile unsigned int old_version = 0;
+	unsigned int old_version = 0;
 
 	for (int i = 0; i < SIZE_OF_SET; i++)
 	{
 		//printf("i:%d, valid:%d, addr: %llu, value: %llu\n", i, ws[i].valid, ws[i].addr, ws[i].value);
 		if (ws[i].valid == 1)
 		{
-			if (!TRY_LOCK(locks[ws[i].addr]))
+			if (!TRY_LOCK(table.lock(ws[i].addr)))
 			{
 				/* if fails to lock */
 				for (int j = 0; j < i; j++)
 				{
 					if (ws[j].valid == 1)
-						old_version = GET_VERSION(locks[ws[j].addr]);
-						UNLOCK(locks[ws[j].addr], old_version);
+					{
+						old_version = GET_VERSION(table.lock(ws[j].addr));
+						UNLOCK(table.lock(ws[j].addr), old_version);
+					}
 				}
 				/* abort */
 				return 0;
@@ -125,35 +130,33 @@ int tx_commit(struct write_set *ws, struct read_set *rs, unsigned int rv)
 		}
 	}
 
-	wv = __sync_fetch_and_add(&global_clock, 1);
-MFENCE;
+	/* the RMW also orders the lock acquisitions before the validation */
+	wv = global_clock.fetch_add(1, std::memory_order_acq_rel) + 1;
 	/* Validate the read-set */
 	for (int i = 0; i < SIZE_OF_SET; i++)
 	{
-loop:
-		if (i == SIZE_OF_SET)
-			break;
-
 		if (rs[i].valid == 1)
 		{
+			/* our own locks are held, but the version still has to match */
+			int own = 0;
 			for (int h = 0; h < SIZE_OF_SET; h++)
 			{
-				if ( rs[i].addr == ws[h].addr )
+				if (ws[h].valid == 1 && rs[i].addr == ws[h].addr)
 				{
-					i++;
-					goto loop;
+					own = 1;
+					break;
 				}
 			}
 
-			if ( GET_VERSION(locks[rs[i].addr]) > rv || IS_LOCKED(locks[rs[i].addr]) )
+			if ( GET_VERSION(table.lock(rs[i].addr)) > rv || (!own && IS_LOCKED(table.lock(rs[i].addr))) )
 			{
 				for (int j = 0; j < SIZE_OF_SET; j++)
 				{
 					/* unlock the wirte-set's lock */
 					if(ws[j].valid == 1)
 					{
-						old_version = GET_VERSION(locks[ws[j].addr]);
-						UNLOCK(locks[ws[j].addr], old_version);
+						old_version = GET_VERSION(table.lock(ws[j].addr));
+						UNLOCK(table.lock(ws[j].addr), old_version);
 					}
 				}
 				/* abort */
@@ -161,17 +164,20 @@ loop:
 			}
 		}
 	}
-MFENCE;
+
+	/* try_lock only acquires; keep the write-back behind the locks */
+	std::atomic_thread_fence(std::memory_order_release);
+
 	/* Now transaction is valid and can be committed */
 	for (int i = 0; i < SIZE_OF_SET; i++)
 	{
 		if (ws[i].valid == 1)
 		{
-			if (IS_LOCKED(locks[ws[i].addr]))
+			if (IS_LOCKED(table.lock(ws[i].addr)))
 			{	
 				/* write back */
-				accounts[ws[i].addr] = ws[i].value;
-				UNLOCK(locks[ws[i].addr], wv);
+				table.value(ws[i].addr).store(ws[i].value, std::memory_order_relaxed);
+				UNLOCK(table.lock(ws[i].addr), wv);
 			}
 			else
 			{
@@ -179,7 +185,7 @@ MFENCE;
 			}
 		}
 	}
-MFENCE;
+
 	return 1;
 }
 
@@ -193,13 +199,12 @@ unsigned int tx_read(struct write_set *ws, struct read_set *rs, unsigned int add
 			return ws[i].value;
 	}
 
-	v1 = GET_VERSION(locks[addr]);
-	CFENCE;
-	value = accounts[addr]; 
-	CFENCE;
-	v2 = GET_VERSION(locks[addr]);
+	v1 = GET_VERSION(table.lock(addr));
+	value = table.value(addr).load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	v2 = (table.lock(addr).load(std::memory_order_relaxed) >> 1);
 	
-	if ( (v2 <= rv) && (v1 == v2) && !(IS_LOCKED(locks[addr])) )
+	if ( (v2 <= rv) && (v1 == v2) && !(IS_LOCKED(table.lock(addr))) )
 	{
 		for (int j = 0; j < SIZE_OF_SET; j++)
 		{
@@ -319,12 +324,12 @@ int main(int argc, char* argv[])
 	// initialize accounts
 	for (int i = 0; i < NUM_OF_ACCOUNTS; i++)
 	{ 
-		accounts[i] = 1000;
-		locks[i] = 0;
+		table.value(i).store(1000, std::memory_order_relaxed);
+		table.lock(i).store(0, std::memory_order_relaxed);
 	}
 
 	/* Initialize global clock */
-	global_clock = 0;
+	global_clock.store(0, std::memory_order_release);
 
 	pthread_attr_t thread_attr;
 	pthread_attr_init(&thread_attr);
@@ -342,7 +347,7 @@ int main(int argc, char* argv[])
 	unsigned int total_balance = 0;
 	for (int j = 0; j < NUM_OF_ACCOUNTS; j++)
 	{
-		total_balance = total_balance + accounts[j];
+		total_balance = total_balance + table.value(j).load(std::memory_order_relaxed);
 	}
 	printf("Before: total balance = %u\n", total_balance);
 	
@@ -353,14 +358,14 @@ int main(int argc, char* argv[])
 		pthread_join(client_th[i], NULL);
 	}
 	
-	printf("Time %llu\n", get_real_time() - start);
+	printf("Time %llu (%s layout)\n", get_real_time() - start, table.name());
 	
 	// Verification
 	total_balance = 0;
 	for (int j = 0; j < NUM_OF_ACCOUNTS; j++)
 	{
-	//	printf("%llu\n", accounts[j]);
-		total_balance = total_balance + accounts[j];
+	//	printf("%llu\n", table.value(j));
+		total_balance = total_balance + table.value(j).load(std::memory_order_relaxed);
 	}
 
 	printf("After: total balance = %u\n", total_balance);
@@ -0,0 +1,656 @@
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <getopt.h>
+
+#include "tm/rand_r_32.h"
+#include "tm/trace.hpp"
+#include "tm/results.hpp"
+#include "tm/latency.hpp"
+
+/**
+ *  Single-transfer bank driver. A transfer moves AMOUNT from one account
+ *  to another unless the sender is short of money. The same loop is built
+ *  six ways:
+ *
+ *    -DBANK_KCAS      a 2-CAS over both balances (tm/kcas.hpp)
+ *    -DBANK_LOCK      per-account mutexes taken in index order, like
+ *                     Assignment2's test_threads_fine but with the two
+ *                     updates in one critical section
+ *    -DBANK_DELEGATE  -S server threads own equal slices of the accounts
+ *                     and run the transfers for the clients
+ *                     (tm/delegate.hpp). A transfer across slices is a
+ *                     debit at one owner, then a credit at the other.
+ *    -DBANK_ITM       a __transaction_atomic block (-fgnu-tm), run by
+ *                     gcc's libitm or by libitm_stm.a over RingSTM/TL2
+ *                     ($ITM_ENGINE, see tm/itm.c), depending on the link
+ *    default          a transaction on the engine picked by tm/tm.hpp;
+ *                     -DTM_TL2 is the same algorithm as the Assignment4 STM
+ *
+ *  With -s, that percentage of the accounts picked comes from a hot set of
+ *  -h accounts, so the conflict rate can be swept without changing the
+ *  table size.
+ *
+ *  -w <file> -n <ops> writes the picks each thread would make to a trace
+ *  and exits. -r <file> replays that trace instead of drawing random
+ *  numbers (tm/trace.hpp). Every variant then runs the same transfers.
+ *  -o <file> appends a result record (tm/results.hpp). -l times every
+ *  transfer and prints latency percentiles (tm/latency.hpp).
+ *
+ *  -A <pct> makes that percentage of the transactions audits instead:
+ *  one transaction sums -W consecutive accounts and writes the total to
+ *  the thread's report word. A full-table audit must see the initial
+ *  total. -W is capped by the engine's access log (ACCESS_SIZE).
+ *  Transactional variants only; with -i (TL2) audits run under snapshot
+ *  isolation (TM_SI), so their reads are not validated at commit.
+ *
+ *  -DBANK_LAYOUT=<n> picks where an account lives, as in Assignment4's
+ *  account_layout.hpp:
+ *
+ *    LAYOUT_SPLIT   0  balances in one array, -DBANK_LOCK's mutexes in
+ *                      another. Two lines per locked transfer leg.
+ *    LAYOUT_PACKED  1  balance and mutex side by side (the default). The
+ *                      48-byte lock records straddle lines.
+ *    LAYOUT_PADDED  2  one account per 64-byte line, no false sharing.
+ *
+ *  The other variants keep their metadata away from the balances, so for
+ *  them split and packed are the same array of words and padded spreads
+ *  the words one per line.
+ */
+
+#if defined(BANK_KCAS)
+#include "tm/kcas.hpp"
+#define BANK_ENGINE "kcas"
+typedef kcas_word balance_t;
+#elif defined(BANK_DELEGATE)
+#include "tm/delegate.hpp"
+#define BANK_ENGINE "delegate"
+typedef uint64_t balance_t;
+#elif defined(BANK_ITM)
+#include "tm/wait.hpp"
+#define BANK_ENGINE itm_engine_name()
+typedef uint64_t balance_t;
+extern "C" const char *_ITM_libraryVersion();
+#elif defined(BANK_LOCK)
+#include "tm/wait.hpp"
+#define BANK_ENGINE "lock"
+typedef uint64_t balance_t;
+#else
+#include "tm/tm.hpp"
+#define BANK_ENGINE TM_ENGINE_NAME
+#define BANK_AUDIT 1			/* a transaction can span many accounts */
+typedef uint64_t balance_t;
+#endif
+
+/* an audit logs one read per account plus its report write */
+#if defined(ACCESS_SIZE)
+#define AUDIT_SPAN_MAX (ACCESS_SIZE - 1)
+#else
+#define AUDIT_SPAN_MAX INT_MAX		/* no access log */
+#endif
+
+#define LAYOUT_SPLIT	0
+#define LAYOUT_PACKED	1
+#define LAYOUT_PADDED	2
+
+#ifndef BANK_LAYOUT
+#define BANK_LAYOUT LAYOUT_PACKED
+#endif
+
+#define ACCOUNT_NUM 1048576
+#define INIT_BALANCE 1000
+#define AMOUNT 50
+
+/* Line-aligned and zeroed */
+inline void* alloc_lines(size_t bytes)
+{
+	void *p;
+
+	if (posix_memalign(&p, 64, bytes) != 0) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	memset(p, 0, bytes);
+	return p;
+}
+
+template<int Layout>
+struct account_table;
+
+template<>
+struct account_table<LAYOUT_SPLIT>
+{
+	balance_t *balances;
+#if defined(BANK_LOCK)
+	pthread_mutex_t *locks;
+
+	pthread_mutex_t& lock(int i) { return locks[i]; }
+#endif
+
+	void alloc(int n)
+	{
+		balances = (balance_t*)alloc_lines(sizeof(balance_t) * n);
+#if defined(BANK_LOCK)
+		locks = (pthread_mutex_t*)alloc_lines(sizeof(pthread_mutex_t) * n);
+#endif
+	}
+	balance_t& balance(int i) { return balances[i]; }
+	static const char *name() { return "split"; }
+};
+
+template<>
+struct account_table<LAYOUT_PACKED>
+{
+	struct record
+	{
+		balance_t balance;
+#if defined(BANK_LOCK)
+		pthread_mutex_t lock;
+#endif
+	};
+	record *records;
+
+	void alloc(int n) { records = (record*)alloc_lines(sizeof(record) * n); }
+	balance_t& balance(int i) { return records[i].balance; }
+#if defined(BANK_LOCK)
+	pthread_mutex_t& lock(int i) { return records[i].lock; }
+#endif
+	static const char *name() { return "packed"; }
+};
+
+template<>
+struct account_table<LAYOUT_PADDED>
+{
+	struct alignas(64) record
+	{
+		balance_t balance;
+#if defined(BANK_LOCK)
+		pthread_mutex_t lock;
+#endif
+	};
+	record *records;
+
+	void alloc(int n) { records = (record*)alloc_lines(sizeof(record) * n); }
+	balance_t& balance(int i) { return records[i].balance; }
+#if defined(BANK_LOCK)
+	pthread_mutex_t& lock(int i) { return records[i].lock; }
+#endif
+	static const char *name() { return "padded"; }
+};
+
+account_table<BANK_LAYOUT> accounts;
+
+unsigned int total_threads;
+int num_accounts = ACCOUNT_NUM;
+int skew_pct = 0;		/* % of picks that go to the hot set */
+int hot_accounts = 64;
+int num_servers = 1;		/* delegation servers */
+const char *record_path = NULL;	/* -w: write a trace and exit */
+long record_ops = 1000000;	/* -n: per thread */
+const char *replay_path = NULL;	/* -r: replay this trace */
+const char *result_path = NULL;	/* -o: append a result record */
+trace_file trace;
+bool measure_latency = false;	/* -l */
+lat_hist latencies[300];
+int audit_pct = 0;		/* -A: % of transactions that audit */
+int audit_span = 1024;		/* -W: accounts per audit */
+bool audit_si = false;		/* -i: audits under snapshot isolation */
+uint64_t audit_reports[300 * 8];	/* one line per thread */
+long audits[300], audit_aborts[300], bad_audits[300];
+
+#if defined(BANK_DELEGATE)
+enum bank_op { BANK_TRANSFER, BANK_DEBIT, BANK_CREDIT };
+
+int per_server;			/* accounts owned by each server */
+__thread int client_id;
+
+inline int owner(int account)
+{
+	return account / per_server;
+}
+
+/* Runs on the owning server only, so plain accesses are enough */
+uint64_t bank_serve(uint32_t op, uint64_t a0, uint64_t a1, uint64_t a2)
+{
+	switch (op) {
+	case BANK_TRANSFER:
+		if (accounts.balance(a0) < a2)
+			return 0;
+		accounts.balance(a0) -= a2;
+		accounts.balance(a1) += a2;
+		return 1;
+	case BANK_DEBIT:
+		if (accounts.balance(a0) < a1)
+			return 0;
+		accounts.balance(a0) -= a1;
+		return 1;
+	case BANK_CREDIT:
+		accounts.balance(a0) += a1;
+		return 1;
+	}
+	return 0;
+}
+
+void* server_run(void * args)
+{
+	dlg_serve((int)(long)args, bank_serve);
+	return 0;
+}
+#endif
+
+#if defined(BANK_ITM)
+/* which library the binary was linked against */
+const char *itm_engine_name()
+{
+	const char *engine = getenv("ITM_ENGINE");
+
+	if (!strstr(_ITM_libraryVersion(), "libitm_stm"))
+		return "itm-gnu";
+	return engine && !strcmp(engine, "tl2") ? "itm-tl2" : "itm-ring";
+}
+#endif
+
+inline unsigned long long bank_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ *  Support a few lightweight barriers
+ */
+void
+barrier(uint32_t which)
+{
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
+}
+
+std::atomic<bool> ExperimentInProgress(true);
+static void catch_SIGALRM(int sig_num)
+{
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
+}
+
+unsigned long long throughputs[300];
+
+inline int pick(unsigned int *seed)
+{
+	if (skew_pct && (int)(rand_r_32(seed) % 100) < skew_pct)
+		return rand_r_32(seed) % hot_accounts;
+	return rand_r_32(seed) % num_accounts;
+}
+
+inline void transfer(int from, int to, uint64_t amount)
+{
+#if defined(BANK_KCAS)
+	for (;;) {
+		uint64_t a = kcas_read(&accounts.balance(from));
+		uint64_t b = kcas_read(&accounts.balance(to));
+		if (a < amount)
+			return;
+
+		kcas_desc *d = kcas_begin();
+		kcas_add(d, &accounts.balance(from), a, a - amount);
+		kcas_add(d, &accounts.balance(to), b, b + amount);
+		if (kcas_commit(d))
+			return;
+	}
+#elif defined(BANK_DELEGATE)
+	int from_owner = owner(from);
+	int to_owner = owner(to);
+
+	if (from_owner == to_owner)
+		dlg_call(from_owner, client_id, BANK_TRANSFER, from, to, amount);
+	else if (dlg_call(from_owner, client_id, BANK_DEBIT, from, amount, 0))
+		dlg_call(to_owner, client_id, BANK_CREDIT, to, amount, 0);
+#elif defined(BANK_ITM)
+	balance_t *sender = &accounts.balance(from);
+	balance_t *receiver = &accounts.balance(to);
+
+	__transaction_atomic {
+		if (*sender >= amount) {
+			*sender -= amount;
+			*receiver += amount;
+		}
+	}
+#elif defined(BANK_LOCK)
+	pthread_mutex_t *first = &accounts.lock(from < to ? from : to);
+	pthread_mutex_t *second = &accounts.lock(from < to ? to : from);
+
+	pthread_mutex_lock(first);
+	pthread_mutex_lock(second);
+	if (accounts.balance(from) >= amount) {
+		accounts.balance(from) -= amount;
+		accounts.balance(to) += amount;
+	}
+	pthread_mutex_unlock(second);
+	pthread_mutex_unlock(first);
+#else
+	TM_BEGIN
+		uint64_t a = TM_READ(accounts.balance(from));
+		if (a >= amount) {
+			TM_WRITE(accounts.balance(from), a - amount);
+			TM_WRITE(accounts.balance(to), TM_READ(accounts.balance(to)) + amount);
+		}
+	TM_END
+#endif
+}
+
+#if defined(BANK_AUDIT)
+/* Sums audit_span accounts from first and files the total */
+inline void audit(int id, int first)
+{
+	uint64_t sum = 0;
+	long aborts_before = Self->aborts;
+
+	TM_BEGIN
+#if defined(TM_TL2)
+		if (audit_si)
+			TM_SI
+#endif
+		sum = 0;
+		for (int i = 0; i < audit_span; i++)
+			sum += TM_READ(accounts.balance((first + i) % num_accounts));
+		TM_WRITE(audit_reports[id * 8], sum);
+	TM_END
+	audits[id]++;
+	audit_aborts[id] += Self->aborts - aborts_before;
+	if (audit_span == num_accounts && sum != (uint64_t)INIT_BALANCE * num_accounts)
+		bad_audits[id]++;
+}
+#endif
+
+inline uint64_t balance(int i)
+{
+#if defined(BANK_KCAS)
+	return kcas_read(&accounts.balance(i));
+#else
+	return accounts.balance(i);
+#endif
+}
+
+void* th_run(void * args)
+{
+	int id = ((long)args);
+
+#if defined(BANK_KCAS)
+	kcas_thread_init(id);
+#elif defined(BANK_DELEGATE)
+	client_id = id;
+#elif !defined(BANK_LOCK) && !defined(BANK_ITM)
+	thread_init(id);
+#endif
+
+	barrier(0);
+	unsigned int seed = id + 1;
+
+	if (id == 0) {
+		signal(SIGALRM, catch_SIGALRM);
+		alarm(1);
+	}
+
+	unsigned long long time = bank_time();
+	unsigned long long tx_count = 0;
+	if (replay_path) {
+		const trace_op *ops = trace_stream(&trace, id);
+		uint64_t n = trace.header->ops, i = 0;
+
+		while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+			unsigned long long start = measure_latency ? bank_time() : 0;
+			transfer(ops[i].from, ops[i].to, ops[i].amount);
+			if (measure_latency)
+				lat_record(&latencies[id], bank_time() - start);
+			tx_count++;
+			if (++i == n)
+				i = 0;
+		}
+	} else {
+		while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+#if defined(BANK_AUDIT)
+			if (audit_pct && (int)(rand_r_32(&seed) % 100) < audit_pct) {
+				unsigned long long start = measure_latency ? bank_time() : 0;
+				audit(id, rand_r_32(&seed) % num_accounts);
+				if (measure_latency)
+					lat_record(&latencies[id], bank_time() - start);
+				tx_count++;
+				continue;
+			}
+#endif
+			int from = pick(&seed);
+			int to = pick(&seed);
+			if (from == to)
+				continue;
+
+			unsigned long long start = measure_latency ? bank_time() : 0;
+			transfer(from, to, AMOUNT);
+			if (measure_latency)
+				lat_record(&latencies[id], bank_time() - start);
+			tx_count++;
+		}
+	}
+	time = bank_time() - time;
+	throughputs[id] = (1000000000LL * tx_count) / (time);
+	return 0;
+}
+
+/* The same picks th_run() makes, written out for replay */
+int record_trace()
+{
+	FILE *f = trace_create(record_path, total_threads, num_accounts, record_ops);
+	trace_op *ops = (trace_op *)malloc(sizeof(trace_op) * record_ops);
+
+	if (!f || !ops) {
+		perror(record_path);
+		return 1;
+	}
+	for (unsigned int id = 0; id < total_threads; id++) {
+		unsigned int seed = id + 1;
+		for (long i = 0; i < record_ops; ) {
+			int from = pick(&seed);
+			int to = pick(&seed);
+			if (from == to)
+				continue;
+
+			ops[i].from = from;
+			ops[i].to = to;
+			ops[i].amount = AMOUNT;
+			ops[i].op = TRACE_TRANSFER;
+			i++;
+		}
+		if (!trace_append(f, ops, record_ops)) {
+			perror(record_path);
+			return 1;
+		}
+	}
+	free(ops);
+	if (fclose(f) != 0) {
+		perror(record_path);
+		return 1;
+	}
+	printf("%u x %ld transfers written to %s\n", total_threads, record_ops, record_path);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "a:s:h:S:w:n:r:o:lA:W:i")) != -1) {
+		switch (opt) {
+		case 'a':
+			num_accounts = atoi(optarg);
+			break;
+		case 's':
+			skew_pct = atoi(optarg);
+			break;
+		case 'h':
+			hot_accounts = atoi(optarg);
+			break;
+		case 'S':
+			num_servers = atoi(optarg);
+			break;
+		case 'w':
+			record_path = optarg;
+			break;
+		case 'n':
+			record_ops = atol(optarg);
+			break;
+		case 'r':
+			replay_path = optarg;
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		case 'l':
+			measure_latency = true;
+			break;
+		case 'A':
+			audit_pct = atoi(optarg);
+			break;
+		case 'W':
+			audit_span = atoi(optarg);
+			break;
+		case 'i':
+			audit_si = true;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (replay_path) {
+		if (!trace_open(replay_path, &trace)) {
+			printf("%s is not a complete trace\n", replay_path);
+			exit(1);
+		}
+		num_accounts = trace.header->accounts;
+	}
+
+#if !defined(BANK_AUDIT)
+	bool audit_bad = audit_pct != 0 || audit_si;	/* no multi-account transactions */
+#elif !defined(TM_TL2)
+	bool audit_bad = audit_si;			/* TM_SI is TL2 only */
+#else
+	bool audit_bad = false;
+#endif
+	audit_bad |= audit_pct < 0 || (audit_pct && (audit_span < 1 || audit_span > num_accounts ||
+			audit_span > AUDIT_SPAN_MAX));
+
+	if ((optind >= argc && !replay_path) || num_accounts < 2 || hot_accounts < 2 ||
+			hot_accounts > num_accounts || num_servers < 1 || num_servers > 64 || record_ops < 1 ||
+			audit_bad) {
+		printf("Usage bank [-a accounts] [-s hot %%] [-h hot accounts] [-S servers] "
+				"[-w trace -n ops | -r trace] [-o result file] [-l] "
+				"[-A audit %% [-W audit span] [-i]] threads#\n");
+		exit(0);
+	}
+
+	int threads = optind < argc ? atoi(argv[optind]) : trace.header->threads;
+	total_threads = threads > 0 ? threads : 1;
+	if (record_path)
+		return record_trace();
+	if (replay_path && total_threads != trace.header->threads) {
+		printf("%s was recorded for %u threads\n", replay_path, trace.header->threads);
+		exit(1);
+	}
+
+#if !defined(BANK_KCAS) && !defined(BANK_LOCK) && !defined(BANK_DELEGATE) && !defined(BANK_ITM)
+	tm_sys_init();
+#endif
+
+	accounts.alloc(num_accounts);
+	for (int i = 0; i < num_accounts; i++) {
+#if defined(BANK_KCAS)
+		kcas_init(&accounts.balance(i), INIT_BALANCE);
+#else
+		accounts.balance(i) = INIT_BALANCE;
+#endif
+#if defined(BANK_LOCK)
+		pthread_mutex_init(&accounts.lock(i), NULL);
+#endif
+	}
+
+#if defined(BANK_DELEGATE)
+	pthread_t server_th[64];
+	per_server = (num_accounts + num_servers - 1) / num_servers;
+	dlg_init(num_servers, total_threads);
+	for (long s = 0; s < num_servers; s++)
+		pthread_create(&server_th[s], NULL, server_run, (void*)s);
+#endif
+
+	pthread_t client_th[300];
+	for (unsigned long i = 1; i < total_threads; i++)
+		pthread_create(&client_th[i-1], NULL, th_run, (void*)i);
+
+	th_run(0);
+
+	for (unsigned int i = 0; i < total_threads - 1; i++)
+		pthread_join(client_th[i], NULL);
+
+#if defined(BANK_DELEGATE)
+	dlg_stop();
+	for (int s = 0; s < num_servers; s++)
+		pthread_join(server_th[s], NULL);
+#endif
+
+	unsigned long long totalThroughput = 0;
+	for (unsigned int i = 0; i < total_threads; i++)
+		totalThroughput += throughputs[i];
+
+	printf("Throughput = %llu\n", totalThroughput);
+	if (measure_latency) {
+		lat_hist all;
+		memset(&all, 0, sizeof(all));
+		for (unsigned int i = 0; i < total_threads; i++)
+			lat_merge(&all, &latencies[i]);
+		printf("latency ns: p50 = %llu, p99 = %llu, p99.9 = %llu, p99.99 = %llu\n",
+				(unsigned long long)lat_percentile(&all, 50),
+				(unsigned long long)lat_percentile(&all, 99),
+				(unsigned long long)lat_percentile(&all, 99.9),
+				(unsigned long long)lat_percentile(&all, 99.99));
+	}
+	if (result_path) {
+		char config[512];
+		int n = snprintf(config, sizeof(config), "driver=bank accounts=%d skew=%d hot=%d servers=%d trace=%s layout=%s",
+				num_accounts, skew_pct, hot_accounts, num_servers,
+				replay_path ? replay_path : "-", accounts.name());
+		if (audit_pct)
+			snprintf(config + n, sizeof(config) - n, " audit=%d span=%d si=%d",
+					audit_pct, audit_span, audit_si);
+		if (!result_append(result_path, BANK_ENGINE, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+
+	long audited = 0, audit_aborted = 0, audit_wrong = 0;
+	for (unsigned int i = 0; i < total_threads; i++) {
+		audited += audits[i];
+		audit_aborted += audit_aborts[i];
+		audit_wrong += bad_audits[i];
+	}
+	if (audit_pct)
+		printf("audits = %ld, audit aborts = %ld, bad audits = %ld\n",
+				audited, audit_aborted, audit_wrong);
+
+	uint64_t sum = 0;
+	for (int i = 0; i < num_accounts; i++)
+		sum += balance(i);
+
+	printf("sum = %llu, matched = %d\n", (unsigned long long)sum,
+			sum == (uint64_t)INIT_BALANCE * num_accounts && audit_wrong == 0);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/**
+ *  Compares two files of result records (tm/results.hpp), a baseline and
+ *  a new run, and flags slowdowns.
+ *
+ *  Records with the same engine, config and threads are one experiment,
+ *  and each record is one trial. For every experiment present in both
+ *  files with at least MIN_TRIALS trials on each side, the throughputs
+ *  are compared with a two-sided Mann-Whitney U test. The normal
+ *  approximation with a tie correction is used, which is adequate from
+ *  about five trials per side.
+ *
+ *  An experiment is a regression when p < alpha and the new median is
+ *  lower. The exit status is 1 if there is any regression, so a script
+ *  can stop on it.
+ *
+ *  Usage: benchcmp baseline new [alpha]
+ */
+
+#define MIN_TRIALS	5
+#define DEFAULT_ALPHA	0.05
+
+typedef std::map<std::string, std::vector<double> > experiments;
+
+/* engine \t config \t threads \t host \t time \t throughput \t per-thread */
+static bool load(const char *path, experiments& out)
+{
+	FILE *f = fopen(path, "r");
+	char line[8192];
+
+	if (!f)
+		return false;
+	while (fgets(line, sizeof(line), f)) {
+		char *field[6];
+		char *p = line;
+		int n = 0;
+
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		while (n < 6 && p) {
+			field[n++] = p;
+			p = strchr(p, '\t');
+			if (p)
+				*p++ = '\0';
+		}
+		if (n < 6)
+			continue;
+
+		std::string key = std::string(field[0]) + "\t" + field[1] + "\t" + field[2];
+		out[key].push_back(atof(field[5]));
+	}
+	fclose(f);
+	return true;
+}
+
+static double median(std::vector<double> v)
+{
+	std::sort(v.begin(), v.end());
+	size_t n = v.size();
+	return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* Two-sided p-value of the Mann-Whitney U test of a against b */
+static double mann_whitney(const std::vector<double>& a, const std::vector<double>& b)
+{
+	std::vector<std::pair<double, int> > all;
+	double n1 = a.size(), n2 = b.size(), n = n1 + n2;
+
+	for (size_t i = 0; i < a.size(); i++)
+		all.push_back(std::make_pair(a[i], 0));
+	for (size_t i = 0; i < b.size(); i++)
+		all.push_back(std::make_pair(b[i], 1));
+	std::sort(all.begin(), all.end());
+
+	/* midranks; ties shrink the variance by sum(t^3 - t) */
+	double rank_a = 0, ties = 0;
+	for (size_t i = 0; i < all.size(); ) {
+		size_t j = i;
+		while (j < all.size() && all[j].first == all[i].first)
+			j++;
+		double t = j - i, rank = (i + 1 + j) / 2.0;
+		for (size_t k = i; k < j; k++)
+			if (all[k].second == 0)
+				rank_a += rank;
+		ties += t * t * t - t;
+		i = j;
+	}
+
+	double u = rank_a - n1 * (n1 + 1) / 2;
+	double mean = n1 * n2 / 2;
+	double var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+	if (var <= 0)
+		return 1.0;
+
+	/* continuity correction toward the mean */
+	double z = (fabs(u - mean) - 0.5) / sqrt(var);
+	if (z < 0)
+		z = 0;
+	return erfc(z / sqrt(2.0));
+}
+
+int main(int argc, char* argv[])
+{
+	experiments base, cur;
+	double alpha = argc > 3 ? atof(argv[3]) : DEFAULT_ALPHA;
+
+	if (argc < 3 || alpha <= 0 || alpha >= 1) {
+		printf("Usage benchcmp baseline new [alpha]\n");
+		return 2;
+	}
+	if (!load(argv[1], base)) {
+		perror(argv[1]);
+		return 2;
+	}
+	if (!load(argv[2], cur)) {
+		perror(argv[2]);
+		return 2;
+	}
+
+	int regressions = 0, compared = 0;
+	printf("%-40s %5s %5s %14s %14s %8s %8s\n", "engine/config/threads", "n0", "n1",
+			"base median", "new median", "change", "p");
+	for (experiments::iterator i = cur.begin(); i != cur.end(); ++i) {
+		experiments::iterator b = base.find(i->first);
+		if (b == base.end() || b->second.size() < MIN_TRIALS || i->second.size() < MIN_TRIALS)
+			continue;
+
+		double m0 = median(b->second), m1 = median(i->second);
+		double p = mann_whitney(b->second, i->second);
+		bool slower = p < alpha && m1 < m0;
+		std::string name = i->first;
+		std::replace(name.begin(), name.end(), '\t', '/');
+
+		printf("%-40s %5zu %5zu %14.0f %14.0f %7.1f%% %8.4f%s\n", name.c_str(),
+				b->second.size(), i->second.size(), m0, m1,
+				m0 ? (m1 - m0) * 100 / m0 : 0.0, p, slower ? "  REGRESSION" : "");
+		compared++;
+		regressions += slower;
+	}
+	printf("%d experiments compared, %d regressions at alpha = %g\n", compared, regressions, alpha);
+	return regressions ? 1 : 0;
+}
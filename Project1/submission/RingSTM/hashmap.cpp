@@ -0,0 +1,335 @@
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "tm/rand_r_32.h"
+#include "tm/results.hpp"
+
+/**
+ *  Hash map driver: keys in [1, -r range], half of them present at the
+ *  start. Every transaction runs -n operations on random keys: a lookup,
+ *  or with -u percent probability an insert or a remove, half and half.
+ *  A key always maps to VALUE(key), so a value that comes back wrong
+ *  after an abort shows up in the final check.
+ *
+ *    -DHASHMAP_BOOST  a cmap (tm/cmap.hpp) behind abstract per-key locks
+ *                     (tm/boosting.hpp)
+ *    default          chained buckets of words plus a size counter, read
+ *                     and written by the engine picked by tm/tm.hpp
+ *
+ *  The word-level map conflicts on a shared bucket head or the counter
+ *  even when the keys differ; the boosted one only on equal keys.
+ */
+
+#if defined(HASHMAP_BOOST)
+#include "tm/boosting.hpp"
+#define HASHMAP_ENGINE "boost"
+#else
+#include "tm/tm.hpp"
+#include "tm/cmap.hpp"
+#define HASHMAP_ENGINE TM_ENGINE_NAME
+#endif
+
+#define MAX_OPS 64
+#define VALUE(key) ((key) * 2 + 1)
+
+unsigned int total_threads;
+int key_range = 4096;		/* -r */
+int num_buckets = 1024;		/* -b */
+int tx_ops = 4;			/* -n */
+int update_pct = 50;		/* -u */
+const char *result_path = NULL;	/* -o: append a result record */
+
+#if defined(HASHMAP_BOOST)
+cmap map;
+#else
+struct map_node
+{
+	uint64_t key;
+	uint64_t val;
+	uint64_t next;			/* map_node * */
+};
+
+uint64_t* buckets;		/* map_node * each */
+uint64_t map_size[8];		/* [0], alone on its line */
+#endif
+
+inline unsigned long long hashmap_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ *  Support a few lightweight barriers
+ */
+void
+barrier(uint32_t which)
+{
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
+}
+
+std::atomic<bool> ExperimentInProgress(true);
+static void catch_SIGALRM(int sig_num)
+{
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
+}
+
+unsigned long long throughputs[300];
+long size_change[300];
+long wrong_values[300];
+
+enum { OP_LOOKUP, OP_INSERT, OP_REMOVE };
+
+struct map_op
+{
+	int kind;
+	uint64_t key;
+};
+
+#if defined(HASHMAP_BOOST)
+/* Runs ops as one transaction; returns the change in size */
+long run_ops(map_op *ops, int n, long *wrong)
+{
+	long delta = 0, bad = 0;
+
+	BOOST_BEGIN
+		delta = 0;
+		bad = 0;
+		for (int i = 0; i < n; i++) {
+			uint64_t key = ops[i].key, val;
+			switch (ops[i].kind) {
+			case OP_LOOKUP:
+				if (boosted_lookup(btx, &map, key, &val) && val != VALUE(key))
+					bad++;
+				break;
+			case OP_INSERT:
+				delta += boosted_insert(btx, &map, key, VALUE(key));
+				break;
+			default:
+				if (boosted_remove(btx, &map, key, &val)) {
+					delta--;
+					if (val != VALUE(key))
+						bad++;
+				}
+				break;
+			}
+		}
+	BOOST_END
+	*wrong += bad;
+	return delta;
+}
+#else
+FORCE_INLINE uint64_t* bucket_of(uint64_t key)
+{
+	return &buckets[cmap_hash(key) % num_buckets];
+}
+
+long run_ops(map_op *ops, int n, long *wrong)
+{
+	map_node* fresh[MAX_OPS];
+	bool linked[MAX_OPS];
+	long delta = 0, bad = 0;
+
+	for (int i = 0; i < n; i++) {
+		fresh[i] = NULL;
+		if (ops[i].kind == OP_INSERT) {
+			fresh[i] = (map_node*)malloc(sizeof(map_node));
+			fresh[i]->key = ops[i].key;
+			fresh[i]->val = VALUE(ops[i].key);
+		}
+	}
+
+	TM_BEGIN
+		delta = 0;
+		bad = 0;
+		for (int i = 0; i < n; i++)
+			linked[i] = false;
+		for (int i = 0; i < n; i++) {
+			uint64_t key = ops[i].key;
+			uint64_t* link = bucket_of(key);
+			map_node* curr = (map_node*)TM_READ(*link);
+
+			while (curr && TM_READ(curr->key) != key) {
+				link = &curr->next;
+				curr = (map_node*)TM_READ(*link);
+			}
+			switch (ops[i].kind) {
+			case OP_LOOKUP:
+				if (curr && TM_READ(curr->val) != VALUE(key))
+					bad++;
+				break;
+			case OP_INSERT:
+				if (!curr) {
+					uint64_t* head = bucket_of(key);
+					fresh[i]->next = TM_READ(*head);
+					TM_WRITE(*head, (uint64_t)fresh[i]);
+					TM_WRITE(map_size[0], TM_READ(map_size[0]) + 1);
+					linked[i] = true;
+					delta++;
+				}
+				break;
+			default:
+				if (curr) {
+					if (TM_READ(curr->val) != VALUE(key))
+						bad++;
+					TM_WRITE(*link, TM_READ(curr->next));
+					TM_WRITE(map_size[0], TM_READ(map_size[0]) - 1);
+					delta--;
+				}
+				break;
+			}
+		}
+	TM_END
+
+	/* nodes that went in belong to the map; removed ones are never freed */
+	for (int i = 0; i < n; i++)
+		if (fresh[i] && !linked[i])
+			free(fresh[i]);
+	*wrong += bad;
+	return delta;
+}
+#endif
+
+void* th_run(void * args)
+{
+	int id = ((long)args);
+#if defined(HASHMAP_BOOST)
+	boost_thread_init(id);
+#else
+	thread_init(id);
+#endif
+
+	barrier(0);
+	unsigned int seed = id + 1;
+	if (id == 0) {
+		signal(SIGALRM, catch_SIGALRM);
+		alarm(1);
+	}
+
+	map_op ops[MAX_OPS];
+	unsigned long long time = hashmap_time();
+	unsigned long long tx_count = 0;
+	while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+		for (int i = 0; i < tx_ops; i++) {
+			int op = rand_r_32(&seed) % 100;
+			ops[i].kind = op >= update_pct ? OP_LOOKUP : (op & 1) ? OP_INSERT : OP_REMOVE;
+			ops[i].key = rand_r_32(&seed) % key_range + 1;
+		}
+		size_change[id] += run_ops(ops, tx_ops, &wrong_values[id]);
+		tx_count++;
+	}
+	time = hashmap_time() - time;
+	throughputs[id] = (1000000000LL * tx_count) / (time);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "r:b:n:u:o:")) != -1) {
+		switch (opt) {
+		case 'r':
+			key_range = atoi(optarg);
+			break;
+		case 'b':
+			num_buckets = atoi(optarg);
+			break;
+		case 'n':
+			tx_ops = atoi(optarg);
+			break;
+		case 'u':
+			update_pct = atoi(optarg);
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind >= argc || key_range < 2 || num_buckets < 1 || tx_ops < 1 || tx_ops > MAX_OPS) {
+		printf("Usage %s [-r key range] [-b buckets] [-n ops per tx] [-u update %%] [-o result file] threads#\n",
+				argv[0]);
+		exit(0);
+	}
+	total_threads = atoi(argv[optind]);
+	if (total_threads < 1)
+		total_threads = 1;
+
+#if defined(HASHMAP_BOOST)
+	cmap_init(&map, num_buckets);
+	boost_thread_init(0);
+#else
+	tm_sys_init();
+	tm_admission_init(total_threads);
+	buckets = (uint64_t*)calloc(num_buckets, sizeof(uint64_t));
+	thread_init(0);
+#endif
+
+	/* half the keys, through the map itself */
+	unsigned int seed = total_threads;
+	long initial = 0, wrong = 0;
+	while (initial < key_range / 2) {
+		map_op op = { OP_INSERT, (uint64_t)(rand_r_32(&seed) % key_range + 1) };
+		initial += run_ops(&op, 1, &wrong);
+	}
+
+	pthread_t client_th[300];
+	for (unsigned long i = 1; i < total_threads; i++)
+		pthread_create(&client_th[i-1], NULL, th_run, (void*)i);
+
+	th_run(0);
+
+	for (unsigned int i = 0; i < total_threads - 1; i++)
+		pthread_join(client_th[i], NULL);
+
+	unsigned long long totalThroughput = 0;
+	long expected = initial;
+	for (unsigned int i = 0; i < total_threads; i++) {
+		totalThroughput += throughputs[i];
+		expected += size_change[i];
+		wrong += wrong_values[i];
+	}
+
+	printf("Throughput = %llu\n", totalThroughput);
+	if (result_path) {
+		char config[256];
+		snprintf(config, sizeof(config), "driver=hashmap range=%d buckets=%d ops=%d update=%d",
+				key_range, num_buckets, tx_ops, update_pct);
+		if (!result_append(result_path, HASHMAP_ENGINE, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+
+	long size = 0;
+	bool counter_ok = true;
+#if defined(HASHMAP_BOOST)
+	size = cmap_size(&map);
+#else
+	for (int b = 0; b < num_buckets; b++)
+		for (map_node* m = (map_node*)buckets[b]; m; m = (map_node*)m->next)
+			size++;
+	counter_ok = map_size[0] == (uint64_t)size;
+#endif
+
+	printf("size = %ld, expected = %ld, wrong values = %ld, matched = %d\n",
+			size, expected, wrong, size == expected && counter_ok && wrong == 0);
+
+	return 0;
+}
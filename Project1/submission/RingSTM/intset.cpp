@@ -0,0 +1,329 @@
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "tm/tm.hpp"
+#include "tm/rand_r_32.h"
+#include "tm/results.hpp"
+
+/**
+ *  Integer set driver: a sorted linked list (-s list) or a skip list
+ *  (-s skip) of keys in [1, -r range], filled to half the range. A
+ *  transaction looks a key up or, with -u percent probability, inserts or
+ *  removes one, half and half.
+ *
+ *  -m picks how the search phase reads (TL2 only, see tm/elastic.hpp):
+ *
+ *    tx        plain reads; the read set grows with the path
+ *    release   every node we move past is released again
+ *    elastic   an elastic search, checked on a sliding window
+ *
+ *  A remove also writes the next pointers of the node it unlinks, so a
+ *  transaction that read them (to insert after it, or as a predecessor)
+ *  conflicts with it. The skip list reads its predecessors again once
+ *  the search is over, since the window or the released read set does
+ *  not cover them.
+ */
+
+#define MAX_LEVEL 16
+#define KEY_MIN 0
+#define KEY_MAX UINT64_MAX
+
+enum { MODE_TX, MODE_RELEASE, MODE_ELASTIC };
+
+struct node
+{
+	uint64_t key;
+	uint64_t level;
+	uint64_t next[1];			/* level of them */
+};
+
+node* head;
+
+unsigned int total_threads;
+bool skip_list = false;		/* -s */
+int mode = MODE_TX;		/* -m */
+int key_range = 1024;		/* -r */
+int update_pct = 20;		/* -u */
+const char *result_path = NULL;	/* -o: append a result record */
+
+/**
+ *  Support a few lightweight barriers
+ */
+void
+barrier(uint32_t which)
+{
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
+}
+
+std::atomic<bool> ExperimentInProgress(true);
+static void catch_SIGALRM(int sig_num)
+{
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
+}
+
+unsigned long long throughputs[300];
+long size_change[300];
+long aborts[300];
+
+node* new_node(uint64_t key, int level)
+{
+	node* n = (node*)malloc(sizeof(node) + (level - 1) * sizeof(uint64_t));
+	n->key = key;
+	n->level = level;
+	return n;
+}
+
+int random_level(unsigned int *seed)
+{
+	int level = 1;
+	while (level < MAX_LEVEL && (rand_r_32(seed) & 1))
+		level++;
+	return level;
+}
+
+/**
+ *  Fills preds/succs with the last node below key and the first node at
+ *  or above it, on every level from top down. Returns the key of succs[0].
+ */
+inline uint64_t search(Tx_Context* tx, uint64_t key, int top, node** preds, node** succs)
+{
+	node* pred = head;
+
+	if (mode == MODE_ELASTIC)
+		tm_elastic_begin(tx);
+	for (int l = top - 1; l >= 0; l--) {
+		node* curr = (node*)TM_READ(pred->next[l]);
+		uint64_t k;
+		while ((k = TM_READ(curr->key)) < key) {
+			if (mode == MODE_RELEASE && pred != head) {
+				TM_RELEASE(pred->next[l]);
+				TM_RELEASE(curr->key);
+			}
+			pred = curr;
+			curr = (node*)TM_READ(curr->next[l]);
+		}
+		preds[l] = pred;
+		succs[l] = curr;
+		if (l == 0)
+			return k;
+	}
+	return KEY_MAX;
+}
+
+/* After the search, on levels the read set may no longer cover */
+inline void recheck(Tx_Context* tx, int from, int to, node** preds, node** succs)
+{
+	TM_SETTLE
+	for (int l = from; l < to; l++)
+		if ((node*)TM_READ(preds[l]->next[l]) != succs[l])
+			tm_abort(tx, ABORT_CONFLICT);
+}
+
+bool set_contains(uint64_t key)
+{
+	node* preds[MAX_LEVEL];
+	node* succs[MAX_LEVEL];
+	bool found = false;
+
+	TM_BEGIN
+		found = search(tx, key, skip_list ? MAX_LEVEL : 1, preds, succs) == key;
+	TM_END
+	return found;
+}
+
+bool set_insert(uint64_t key, unsigned int *seed)
+{
+	node* preds[MAX_LEVEL];
+	node* succs[MAX_LEVEL];
+	int level = skip_list ? random_level(seed) : 1;
+	node* n = new_node(key, level);
+	bool done = false;
+
+	TM_BEGIN
+		done = false;
+		if (search(tx, key, skip_list ? MAX_LEVEL : 1, preds, succs) != key) {
+			if (skip_list)
+				recheck(tx, 0, level, preds, succs);
+			for (int l = 0; l < level; l++)
+				n->next[l] = (uint64_t)succs[l];
+			for (int l = 0; l < level; l++)
+				TM_WRITE(preds[l]->next[l], (uint64_t)n);
+			done = true;
+		}
+	TM_END
+	if (!done)
+		free(n);
+	return done;
+}
+
+bool set_remove(uint64_t key)
+{
+	node* preds[MAX_LEVEL];
+	node* succs[MAX_LEVEL];
+	bool done = false;
+
+	TM_BEGIN
+		done = false;
+		if (search(tx, key, skip_list ? MAX_LEVEL : 1, preds, succs) == key) {
+			node* victim = succs[0];
+			int level = (int)TM_READ(victim->level);
+			if (skip_list) {
+				for (int l = 1; l < level; l++)
+					if (succs[l] != victim)
+						tm_abort(tx, ABORT_CONFLICT);
+				recheck(tx, 0, level, preds, succs);
+			}
+			for (int l = 0; l < level; l++) {
+				uint64_t next = TM_READ(victim->next[l]);
+				TM_WRITE(preds[l]->next[l], next);
+				TM_WRITE(victim->next[l], next);	/* conflicts with its readers */
+			}
+			done = true;
+		}
+	TM_END
+	/* a search may still be on it: like TM_FREE, never reclaimed */
+	return done;
+}
+
+void* th_run(void * args)
+{
+	int id = ((long)args);
+	thread_init(id);
+
+	barrier(0);
+	unsigned int seed = id + 1;
+	if (id == 0) {
+		signal(SIGALRM, catch_SIGALRM);
+		alarm(1);
+	}
+
+	long aborts_before = Self->aborts;
+	unsigned long long time = get_real_time();
+	unsigned long long tx_count = 0;
+	while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+		uint64_t key = rand_r_32(&seed) % key_range + 1;
+		int op = rand_r_32(&seed) % 100;
+
+		if (op >= update_pct)
+			set_contains(key);
+		else if (op & 1)
+			size_change[id] += set_insert(key, &seed);
+		else
+			size_change[id] -= set_remove(key);
+		tx_count++;
+	}
+	time = get_real_time() - time;
+	throughputs[id] = (1000000000LL * tx_count) / (time);
+	aborts[id] = Self->aborts - aborts_before;
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "s:m:r:u:o:")) != -1) {
+		switch (opt) {
+		case 's':
+			skip_list = !strcmp(optarg, "skip");
+			break;
+		case 'm':
+			mode = !strcmp(optarg, "elastic") ? MODE_ELASTIC :
+				!strcmp(optarg, "release") ? MODE_RELEASE : MODE_TX;
+			break;
+		case 'r':
+			key_range = atoi(optarg);
+			break;
+		case 'u':
+			update_pct = atoi(optarg);
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind >= argc || key_range < 2) {
+		printf("Usage %s [-s list|skip] [-m tx|release|elastic] [-r key range] [-u update %%] [-o result file] threads#\n",
+				argv[0]);
+		exit(0);
+	}
+	total_threads = atoi(argv[optind]);
+	if (total_threads < 1)
+		total_threads = 1;
+
+	tm_sys_init();
+	tm_admission_init(total_threads);
+
+	node* tail = new_node(KEY_MAX, MAX_LEVEL);
+	head = new_node(KEY_MIN, MAX_LEVEL);
+	for (int l = 0; l < MAX_LEVEL; l++) {
+		head->next[l] = (uint64_t)tail;
+		tail->next[l] = 0;
+	}
+
+	thread_init(0);
+	unsigned int seed = total_threads;
+	long initial = 0;
+	while (initial < key_range / 2)
+		initial += set_insert(rand_r_32(&seed) % key_range + 1, &seed);
+
+	pthread_t client_th[300];
+	for (unsigned long i = 1; i < total_threads; i++)
+		pthread_create(&client_th[i-1], NULL, th_run, (void*)i);
+
+	th_run(0);
+
+	for (unsigned int i = 0; i < total_threads - 1; i++)
+		pthread_join(client_th[i], NULL);
+
+	unsigned long long totalThroughput = 0;
+	long expected = initial, total_aborts = 0;
+	for (unsigned int i = 0; i < total_threads; i++) {
+		totalThroughput += throughputs[i];
+		expected += size_change[i];
+		total_aborts += aborts[i];
+	}
+
+	printf("Throughput = %llu\n", totalThroughput);
+	if (result_path) {
+		char config[256];
+		snprintf(config, sizeof(config), "driver=intset set=%s mode=%s range=%d update=%d",
+				skip_list ? "skip" : "list",
+				mode == MODE_ELASTIC ? "elastic" : mode == MODE_RELEASE ? "release" : "tx",
+				key_range, update_pct);
+		if (!result_append(result_path, TM_ENGINE_NAME, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+
+	/* every level sorted, and the bottom one holds exactly the survivors */
+	long size = 0, unsorted = 0;
+	for (int l = 0; l < (skip_list ? MAX_LEVEL : 1); l++) {
+		for (node* n = (node*)head->next[l]; n->key != KEY_MAX; n = (node*)n->next[l]) {
+			if (((node*)n->next[l])->key <= n->key)
+				unsorted++;
+			if (l == 0)
+				size++;
+		}
+	}
+
+	printf("aborts = %ld, size = %ld, expected = %ld, matched = %d\n",
+			total_aborts, size, expected, size == expected && unsorted == 0);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "tm/rand_r_32.h"
+#include "tm/tm.hpp"
+#include "tm/ordered.hpp"
+
+/**
+ *  A sequential loop run speculatively. Iteration i moves a tenth of one
+ *  account's balance to another, so every iteration depends on what the
+ *  ones before it left in the accounts. Iterations rarely touch the same
+ *  accounts, and with -c that percentage of the picks comes from 16 hot
+ *  accounts. -w adds that many rounds of work on the values read, so the
+ *  transactions are long enough to overlap.
+ *
+ *  The loop runs once plainly and then through parallel_for_speculative()
+ *  (tm/ordered.hpp). The two account tables have to come out identical.
+ */
+
+#define ACCOUNT_NUM 65536
+#define INIT_BALANCE 1000
+#define HOT_ACCOUNTS 16
+
+uint64_t* accounts;
+uint64_t* reference;
+
+long num_iters = 1000000;
+int num_accounts = ACCOUNT_NUM;
+int conflict_pct = 0;		/* % of picks from the hot accounts */
+int work = 0;			/* rounds of work per iteration */
+
+inline unsigned long long loop_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+inline int pick(unsigned int *seed)
+{
+	if (conflict_pct && (int)(rand_r_32(seed) % 100) < conflict_pct)
+		return rand_r_32(seed) % HOT_ACCOUNTS;
+	return rand_r_32(seed) % num_accounts;
+}
+
+/* Iteration i's accounts, the same however often it runs */
+inline void picks(long i, int *from, int *to)
+{
+	unsigned int seed = (unsigned int)i * 2654435761u + 1;
+
+	*from = pick(&seed);
+	do
+		*to = pick(&seed);
+	while (*to == *from);
+}
+
+/* The amount to move, after the busy work that stands in for a real body */
+inline uint64_t amount(uint64_t balance)
+{
+	unsigned int seed = (unsigned int)balance;
+	uint64_t mix = 0, move = balance / 10;
+
+	for (int k = 0; k < work; k++)
+		mix += rand_r_32(&seed);
+	if ((mix & 1) && move)
+		move--;
+	return move;
+}
+
+void step(long i, void *arg, Tx_Context *tx)
+{
+	int from, to;
+
+	picks(i, &from, &to);
+	uint64_t a = TM_READ(accounts[from]);
+	uint64_t move = amount(a);
+	TM_WRITE(accounts[from], a - move);
+	TM_WRITE(accounts[to], TM_READ(accounts[to]) + move);
+}
+
+void step_plain(long i)
+{
+	int from, to;
+
+	picks(i, &from, &to);
+	uint64_t move = amount(reference[from]);
+	reference[from] -= move;
+	reference[to] += move;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "n:a:c:w:")) != -1) {
+		switch (opt) {
+		case 'n':
+			num_iters = atol(optarg);
+			break;
+		case 'a':
+			num_accounts = atoi(optarg);
+			break;
+		case 'c':
+			conflict_pct = atoi(optarg);
+			break;
+		case 'w':
+			work = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-a accounts] [-c conflict%%] [-w work] threads#\n",
+					argv[0]);
+			exit(1);
+		}
+	}
+	if (argc - optind < 1 || num_accounts <= HOT_ACCOUNTS) {
+		fprintf(stderr, "Usage: %s [-n iterations] [-a accounts] [-c conflict%%] [-w work] threads#\n",
+				argv[0]);
+		exit(1);
+	}
+	int threads = atoi(argv[optind]);
+
+	accounts = (uint64_t*)malloc(sizeof(uint64_t) * num_accounts);
+	reference = (uint64_t*)malloc(sizeof(uint64_t) * num_accounts);
+	for (int i = 0; i < num_accounts; i++)
+		accounts[i] = reference[i] = INIT_BALANCE;
+
+	unsigned long long time = loop_time();
+	for (long i = 0; i < num_iters; i++)
+		step_plain(i);
+	unsigned long long plain = loop_time() - time;
+
+	tm_sys_init();
+	thread_init(threads - 1);
+	spec_pool_init(threads, 0);
+
+	time = loop_time();
+	long aborts = parallel_for_speculative(0, num_iters, step, NULL);
+	unsigned long long spec = loop_time() - time;
+
+	spec_pool_stop();
+
+	printf("sequential = %llu us, speculative = %llu us, speedup = %.2f, aborts = %ld\n",
+			plain / 1000, spec / 1000, (double)plain / spec, aborts);
+	printf("matched = %d\n",
+			!memcmp(accounts, reference, sizeof(uint64_t) * num_accounts));
+
+	return 0;
+}
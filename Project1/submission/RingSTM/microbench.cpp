@@ -0,0 +1,311 @@
+#include "tm/tm.hpp"
+#include "tm/BitFilter.h"
+#include "tm/rand_r_32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <atomic>
+#include <x86intrin.h>
+
+/**
+ *  Cost of the engines' building blocks and of the commit path of the
+ *  engine this file is compiled against, in TSC cycles per operation.
+ *
+ *    filter    BitFilter add / lookup / intersect / clear, per filter size
+ *    writeset  WriteSet insert / find / writeback / reset, per set size
+ *    prim      rand_r_32 and the ordering primitives
+ *    tx        empty, one-word and transfer transactions
+ *    shared    lock acquire+release, the barrier and empty transactions
+ *              run by 1, 2, 4 ... -t threads at once
+ *
+ *  Every case runs REPEATS times and the fastest run is reported, the one
+ *  least disturbed by interrupts. With -c each case is one CSV row,
+ *  group,case,param,threads,cycles_per_op, so two runs can be diffed.
+ */
+
+#define ITERATIONS	200000
+#define REPEATS		5
+#define MAX_BENCH_THREADS	64
+#define BIG_WORDS	65536		/* spread addresses over every filter bit */
+
+uint64_t words[64];
+uint64_t big[BIG_WORDS];
+volatile uint64_t sink;			/* keeps results alive */
+
+bool csv = false;
+int max_threads = 4;
+
+/* lfence on both sides keeps the timed loop from leaking past the reads */
+static inline unsigned long long cycles()
+{
+	_mm_lfence();
+	unsigned long long t = __rdtsc();
+	_mm_lfence();
+	return t;
+}
+
+static void report(const char *group, const char *name, long param, int threads, double cpo)
+{
+	if (csv)
+		printf("%s,%s,%ld,%d,%.1f\n", group, name, param, threads, cpo);
+	else
+		printf("%-8s %-18s %8ld %3d %10.1f cycles/op\n", group, name, param, threads, cpo);
+}
+
+/* Runs the statement n times, REPEATS times over, and reports the fastest
+   run divided by n * ops. i is the loop counter. */
+#define MEASURE(group, name, param, n, ops, ...)				\
+	do {								\
+		unsigned long long best = ~0ULL;			\
+		for (int r_ = 0; r_ < REPEATS; r_++) {			\
+			unsigned long long start_ = cycles();		\
+			for (long i = 0; i < (long)(n); i++) {		\
+				__VA_ARGS__;				\
+			}						\
+			unsigned long long t_ = cycles() - start_;	\
+			if (t_ < best)					\
+				best = t_;				\
+		}							\
+		report(group, name, param, 1, (double)best / ((double)(n) * (ops)));	\
+	} while (0)
+
+template <uint32_t BITS>
+void bench_filter()
+{
+	BitFilter<BITS> f, empty;
+
+	MEASURE("filter", "add", BITS, ITERATIONS, 1, f.add(&big[i % BIG_WORDS]));
+	MEASURE("filter", "lookup", BITS, ITERATIONS, 1, sink += f.lookup(&big[i % BIG_WORDS]));
+	/* no common bit, so every word is compared */
+	MEASURE("filter", "intersect", BITS, ITERATIONS / 10, 1, sink += f.intersect(&empty));
+	MEASURE("filter", "clear", BITS, ITERATIONS / 10, 1, f.clear());
+}
+
+void bench_writeset(long size)
+{
+	stm::WriteSet ws(ACCESS_SIZE);
+
+	MEASURE("writeset", "insert", size, ITERATIONS / size, size,
+		ws.reset();
+		for (long j = 0; j < size; j++)
+			ws.insert(stm::WriteSetEntry((void **)&big[j * 8], j)));
+
+	ws.reset();
+	for (long j = 0; j < size; j++)
+		ws.insert(stm::WriteSetEntry((void **)&big[j * 8], big[j * 8]));
+
+	MEASURE("writeset", "find", size, ITERATIONS, 1,
+		stm::WriteSetEntry log((void **)&big[(i % size) * 8]);
+		sink += ws.find(log));
+	MEASURE("writeset", "writeback", size, ITERATIONS / size, size, ws.writeback());
+	MEASURE("writeset", "reset", size, ITERATIONS, 1, ws.reset());
+}
+
+void bench_primitives()
+{
+	unsigned int seed = 1;
+	std::atomic<uint64_t> word(0);
+	volatile uint64_t vword = 0;
+
+	MEASURE("prim", "rand_r_32", 0, ITERATIONS, 1, sink += rand_r_32(&seed));
+	MEASURE("prim", "mfence", 0, ITERATIONS, 1, __asm__ volatile ("mfence":::"memory"));
+	vword = 0;
+	MEASURE("prim", "__sync CAS", 0, ITERATIONS, 1,
+		__sync_bool_compare_and_swap(&vword, vword, vword + 1));
+	MEASURE("prim", "CAS acq_rel", 0, ITERATIONS, 1,
+		uint64_t expected = word.load(std::memory_order_relaxed);
+		word.compare_exchange_strong(expected, expected + 1, std::memory_order_acq_rel));
+	MEASURE("prim", "store seq_cst", 0, ITERATIONS, 1, word.store(i));
+	MEASURE("prim", "store release", 0, ITERATIONS, 1, word.store(i, std::memory_order_release));
+}
+
+void bench_transactions()
+{
+	MEASURE("tx", "empty", 0, ITERATIONS, 1,
+		TM_BEGIN
+		TM_END);
+	MEASURE("tx", "one word", 0, ITERATIONS, 1,
+		TM_BEGIN
+			TM_WRITE(words[0], TM_READ(words[0]) + 1);
+		TM_END);
+	MEASURE("tx", "transfer", 0, ITERATIONS, 1,
+		TM_BEGIN
+			TM_WRITE(words[8], TM_READ(words[8]) - 50);
+			TM_WRITE(words[16], TM_READ(words[16]) + 50);
+		TM_END);
+}
+
+/* the cases every thread of a sweep runs together */
+enum shared_case { SHARED_MUTEX, SHARED_SPIN, SHARED_BARRIER, SHARED_TX, SHARED_CASES };
+
+const char *shared_names[SHARED_CASES] = { "mutex", "spinlock", "barrier", "tx empty" };
+const long shared_iterations[SHARED_CASES] = { ITERATIONS / 4, ITERATIONS / 4, 500, ITERATIONS / 4 };
+
+struct shared_run
+{
+	int which;
+	int threads;
+	pthread_barrier_t start;
+	unsigned long long cycles[MAX_BENCH_THREADS];
+};
+
+pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::atomic<uint32_t> bench_spin(0);
+std::atomic<uint32_t> bench_arrived(0);
+
+/* test-and-test-and-set, waiting the way the engines wait on stripes */
+FORCE_INLINE void spin_lock()
+{
+	tm_waiter w;
+	uint32_t cur;
+
+	tm_wait_reset(&w);
+	for (;;) {
+		cur = 0;
+		if (bench_spin.compare_exchange_weak(cur, 1, std::memory_order_acquire))
+			return;
+		tm_wait(&w, &bench_spin, cur);
+	}
+}
+
+FORCE_INLINE void spin_unlock()
+{
+	bench_spin.store(0, std::memory_order_release);
+	tm_wake(&bench_spin);
+}
+
+/* The test drivers' barrier, made reusable: episode k waits for k * threads */
+FORCE_INLINE void bench_barrier(uint32_t episode, int threads)
+{
+	tm_waiter w;
+	uint32_t arrived;
+	uint32_t target = episode * threads;
+
+	bench_arrived.fetch_add(1, std::memory_order_acq_rel);
+	tm_wake(&bench_arrived);
+	tm_wait_reset(&w);
+	while ((arrived = bench_arrived.load(std::memory_order_acquire)) < target)
+		tm_wait(&w, &bench_arrived, arrived);
+}
+
+void* shared_thread(void *args)
+{
+	static std::atomic<int> next_id(0);
+	shared_run *run = (shared_run *)args;
+	long n = shared_iterations[run->which];
+	/* any run of threads consecutive tickets is distinct mod threads */
+	int id = next_id.fetch_add(1) % run->threads;
+
+	if (run->which == SHARED_TX)
+		thread_init(id);
+	pthread_barrier_wait(&run->start);
+
+	unsigned long long start = cycles();
+	switch (run->which) {
+	case SHARED_MUTEX:
+		for (long i = 0; i < n; i++) {
+			pthread_mutex_lock(&bench_mutex);
+			words[1]++;
+			pthread_mutex_unlock(&bench_mutex);
+		}
+		break;
+	case SHARED_SPIN:
+		for (long i = 0; i < n; i++) {
+			spin_lock();
+			words[1]++;
+			spin_unlock();
+		}
+		break;
+	case SHARED_BARRIER:
+		for (long i = 0; i < n; i++)
+			bench_barrier(i + 1, run->threads);
+		break;
+	case SHARED_TX:
+		for (long i = 0; i < n; i++) {
+			TM_BEGIN
+			TM_END
+		}
+		break;
+	}
+	run->cycles[id] = cycles() - start;
+	return 0;
+}
+
+/* Mean cycles per operation per thread, fastest of REPEATS runs */
+void bench_shared(int which, int threads)
+{
+	double best = 0;
+
+	for (int r = 0; r < REPEATS; r++) {
+		shared_run run;
+		pthread_t th[MAX_BENCH_THREADS];
+
+		run.which = which;
+		run.threads = threads;
+		pthread_barrier_init(&run.start, NULL, threads);
+		bench_arrived.store(0, std::memory_order_relaxed);
+		for (long t = 0; t < threads; t++)
+			pthread_create(&th[t], NULL, shared_thread, &run);
+		for (int t = 0; t < threads; t++)
+			pthread_join(th[t], NULL);
+		pthread_barrier_destroy(&run.start);
+
+		unsigned long long total = 0;
+		for (int t = 0; t < threads; t++)
+			total += run.cycles[t];
+		double cpo = (double)total / threads / shared_iterations[which];
+		if (r == 0 || cpo < best)
+			best = cpo;
+	}
+	report("shared", shared_names[which], 0, threads, best);
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "ct:")) != -1) {
+		switch (opt) {
+		case 'c':
+			csv = true;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			max_threads = 0;
+			break;
+		}
+	}
+
+	if (max_threads < 1 || max_threads > MAX_BENCH_THREADS) {
+		printf("Usage microbench [-c] [-t max threads]\n");
+		exit(0);
+	}
+
+	tm_sys_init();
+	thread_init(0);
+
+	if (csv)
+		printf("group,case,param,threads,cycles_per_op\n");
+
+	bench_filter<1024>();
+	bench_filter<4096>();
+	bench_filter<16384>();
+
+	for (long size = 1; size <= 512; size *= 8)
+		bench_writeset(size);
+
+	bench_primitives();
+	bench_transactions();
+
+	for (int which = 0; which < SHARED_CASES; which++)
+		for (int threads = 1; threads <= max_threads; threads *= 2)
+			bench_shared(which, threads);
+
+	TM_TX_VAR
+	if (!csv)
+		printf("commits = %ld, aborts = %ld\n", tx->commits, tx->aborts);
+	return 0;
+}
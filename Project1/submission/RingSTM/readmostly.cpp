@@ -0,0 +1,170 @@
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "tm/tm.hpp"
+#include "tm/rand_r_32.h"
+#include "tm/results.hpp"
+
+/**
+ *  Read-mostly driver: a table of configuration records, each -r words
+ *  long. A lookup reads one whole record. With -u percent probability a
+ *  transaction instead bumps every word of one record. All the words of a
+ *  record are therefore always equal, and a lookup that sees them differ
+ *  has read an inconsistent record.
+ *
+ *  Built once per engine (tm/tm.hpp) to compare them at low write ratios.
+ */
+
+#define RECORD_NUM 1024
+#define MAX_WORDS 64
+
+uint64_t* records;
+
+unsigned int total_threads;
+int num_records = RECORD_NUM;
+int record_words = 8;
+int update_pct = 5;		/* % of transactions that write */
+const char *result_path = NULL;	/* -o: append a result record */
+
+/**
+ *  Support a few lightweight barriers
+ */
+void
+barrier(uint32_t which)
+{
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
+}
+
+std::atomic<bool> ExperimentInProgress(true);
+static void catch_SIGALRM(int sig_num)
+{
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
+}
+
+unsigned long long throughputs[300];
+long inconsistent[300];
+
+void* th_run(void * args)
+{
+	int id = ((long)args);
+	thread_init(id);
+
+	barrier(0);
+	unsigned int seed = id + 1;
+	if (id == 0) {
+		signal(SIGALRM, catch_SIGALRM);
+		alarm(1);
+	}
+
+	unsigned long long time = get_real_time();
+	unsigned long long tx_count = 0;
+	while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+		uint64_t *rec = &records[(rand_r_32(&seed) % num_records) * record_words];
+		bool update = (int)(rand_r_32(&seed) % 100) < update_pct;
+		bool torn = false;
+
+		TM_BEGIN
+			if (update) {
+				for (int j = 0; j < record_words; j++)
+					TM_WRITE(rec[j], TM_READ(rec[j]) + 1);
+			} else {
+				uint64_t first = TM_READ(rec[0]);
+				torn = false;
+				for (int j = 1; j < record_words; j++)
+					if (TM_READ(rec[j]) != first)
+						torn = true;
+			}
+		TM_END
+		if (torn)
+			inconsistent[id]++;
+		tx_count++;
+	}
+	time = get_real_time() - time;
+	throughputs[id] = (1000000000LL * tx_count) / (time);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "e:r:u:o:")) != -1) {
+		switch (opt) {
+		case 'e':
+			num_records = atoi(optarg);
+			break;
+		case 'r':
+			record_words = atoi(optarg);
+			break;
+		case 'u':
+			update_pct = atoi(optarg);
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind >= argc || num_records < 1 || record_words < 1 || record_words > MAX_WORDS) {
+		printf("Usage %s [-e records] [-r words per record] [-u update %%] [-o result file] threads#\n",
+				argv[0]);
+		exit(0);
+	}
+	total_threads = atoi(argv[optind]);
+	if (total_threads < 1)
+		total_threads = 1;
+
+	tm_sys_init();
+	tm_admission_init(total_threads);
+	records = (uint64_t*)calloc((size_t)num_records * record_words, sizeof(uint64_t));
+
+	pthread_t client_th[300];
+	for (unsigned long i = 1; i < total_threads; i++)
+		pthread_create(&client_th[i-1], NULL, th_run, (void*)i);
+
+	th_run(0);
+
+	for (unsigned int i = 0; i < total_threads - 1; i++)
+		pthread_join(client_th[i], NULL);
+
+	unsigned long long totalThroughput = 0;
+	long torn = 0;
+	for (unsigned int i = 0; i < total_threads; i++) {
+		totalThroughput += throughputs[i];
+		torn += inconsistent[i];
+	}
+
+	printf("Throughput = %llu\n", totalThroughput);
+	if (result_path) {
+		char config[256];
+		snprintf(config, sizeof(config), "driver=readmostly records=%d words=%d update=%d",
+				num_records, record_words, update_pct);
+		if (!result_append(result_path, TM_ENGINE_NAME, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+
+	long bad = 0;
+	for (int i = 0; i < num_records; i++)
+		for (int j = 1; j < record_words; j++)
+			if (records[i * record_words + j] != records[i * record_words])
+				bad++;
+
+	printf("inconsistent lookups = %ld, torn records = %ld, matched = %d\n",
+			torn, bad, torn == 0 && bad == 0);
+
+	return 0;
+}
@@ -0,0 +1,315 @@
+
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "tm/rand_r_32.h"
+#include "tm/results.hpp"
+
+/**
+ *  Struct-heavy driver: a table of account records, each a balance plus
+ *  bookkeeping fields. A transfer moves AMOUNT between two records and
+ *  updates every field of both: the balance, the number of updates, the
+ *  last peer and a short history of balances. With -u below 100, the
+ *  remaining transactions read one whole record.
+ *
+ *    -DRECORDS_OBJ   records are tm_obj<record> and a transfer opens two
+ *                    objects (tm/object.hpp)
+ *    default         records are plain words read and written one at a
+ *                    time by the engine picked by tm/tm.hpp
+ *
+ *  The sum of the balances is conserved, the update counts add up to
+ *  twice the transfers, and every lookup must find the history in step
+ *  with the balance.
+ */
+
+#if defined(RECORDS_OBJ)
+#include "tm/object.hpp"
+#define RECORDS_ENGINE "obj"
+#else
+#include "tm/tm.hpp"
+#define RECORDS_ENGINE TM_ENGINE_NAME
+#endif
+
+#define RECORD_NUM 4096
+#define HISTORY 4
+#define INIT_BALANCE 1000
+#define AMOUNT 5
+
+struct record
+{
+	uint64_t balance;
+	uint64_t updates;
+	uint64_t last_peer;
+	uint64_t history[HISTORY];	/* balances after the last updates */
+	uint64_t checksum;		/* balance ^ updates ^ last_peer */
+};
+
+#if defined(RECORDS_OBJ)
+tm_obj<record>** records;
+#else
+record* records;
+#endif
+
+unsigned int total_threads;
+int num_records = RECORD_NUM;
+int update_pct = 100;		/* % of transactions that transfer */
+const char *result_path = NULL;	/* -o: append a result record */
+
+inline unsigned long long records_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/**
+ *  Support a few lightweight barriers
+ */
+void
+barrier(uint32_t which)
+{
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
+}
+
+std::atomic<bool> ExperimentInProgress(true);
+static void catch_SIGALRM(int sig_num)
+{
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
+}
+
+unsigned long long throughputs[300];
+long transfers[300];
+long inconsistent[300];
+
+/* A record after a change of delta from peer */
+inline void record_update(record *r, int64_t delta, uint64_t peer)
+{
+	r->balance += delta;
+	r->updates++;
+	r->last_peer = peer;
+	for (int h = HISTORY - 1; h > 0; h--)
+		r->history[h] = r->history[h - 1];
+	r->history[0] = r->balance;
+	r->checksum = r->balance ^ r->updates ^ r->last_peer;
+}
+
+inline bool record_consistent(const record *r)
+{
+	return r->history[0] == r->balance &&
+		r->checksum == (r->balance ^ r->updates ^ r->last_peer);
+}
+
+#if defined(RECORDS_OBJ)
+inline bool transfer(int from, int to)
+{
+	bool done = false;
+
+	OBJ_BEGIN
+		done = false;
+		if (OBJ_READ(records[from])->balance >= AMOUNT) {
+			record_update(OBJ_WRITE(records[from]), -AMOUNT, to);
+			record_update(OBJ_WRITE(records[to]), AMOUNT, from);
+			done = true;
+		}
+	OBJ_END
+	return done;
+}
+
+inline bool lookup(int i)
+{
+	bool ok = true;
+
+	OBJ_BEGIN
+		ok = record_consistent(OBJ_READ(records[i]));
+	OBJ_END
+	return ok;
+}
+#else
+/* Word by word, as the engine sees it */
+inline void tm_record_update(Tx_Context *tx, record *r, int64_t delta, uint64_t peer)
+{
+	uint64_t balance = TM_READ(r->balance) + delta;
+	uint64_t updates = TM_READ(r->updates) + 1;
+
+	TM_WRITE(r->balance, balance);
+	TM_WRITE(r->updates, updates);
+	TM_WRITE(r->last_peer, peer);
+	for (int h = HISTORY - 1; h > 0; h--)
+		TM_WRITE(r->history[h], TM_READ(r->history[h - 1]));
+	TM_WRITE(r->history[0], balance);
+	TM_WRITE(r->checksum, balance ^ updates ^ peer);
+}
+
+inline bool transfer(int from, int to)
+{
+	bool done = false;
+
+	TM_BEGIN
+		done = false;
+		if (TM_READ(records[from].balance) >= AMOUNT) {
+			tm_record_update(tx, &records[from], -AMOUNT, to);
+			tm_record_update(tx, &records[to], AMOUNT, from);
+			done = true;
+		}
+	TM_END
+	return done;
+}
+
+inline bool lookup(int i)
+{
+	record copy;
+	uint64_t *from = (uint64_t *)&records[i], *to = (uint64_t *)&copy;
+
+	TM_BEGIN
+		for (unsigned int j = 0; j < sizeof(record) / sizeof(uint64_t); j++)
+			to[j] = TM_READ(from[j]);
+	TM_END
+	return record_consistent(&copy);
+}
+#endif
+
+void* th_run(void * args)
+{
+	int id = ((long)args);
+#if defined(RECORDS_OBJ)
+	obj_thread_init(id);
+#else
+	thread_init(id);
+#endif
+
+	barrier(0);
+	unsigned int seed = id + 1;
+	if (id == 0) {
+		signal(SIGALRM, catch_SIGALRM);
+		alarm(1);
+	}
+
+	unsigned long long time = records_time();
+	unsigned long long tx_count = 0;
+	while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+		int from = rand_r_32(&seed) % num_records;
+		if (update_pct < 100 && (int)(rand_r_32(&seed) % 100) >= update_pct) {
+			if (!lookup(from))
+				inconsistent[id]++;
+		} else {
+			int to = rand_r_32(&seed) % num_records;
+			if (from == to)
+				continue;
+			if (transfer(from, to))
+				transfers[id]++;
+		}
+		tx_count++;
+	}
+	time = records_time() - time;
+	throughputs[id] = (1000000000LL * tx_count) / (time);
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "e:u:o:")) != -1) {
+		switch (opt) {
+		case 'e':
+			num_records = atoi(optarg);
+			break;
+		case 'u':
+			update_pct = atoi(optarg);
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+	if (optind >= argc || num_records < 2) {
+		printf("Usage %s [-e records] [-u update %%] [-o result file] threads#\n", argv[0]);
+		exit(0);
+	}
+	total_threads = atoi(argv[optind]);
+	if (total_threads < 1)
+		total_threads = 1;
+
+	record init;
+	memset(&init, 0, sizeof(init));
+	init.balance = INIT_BALANCE;
+	for (int h = 0; h < HISTORY; h++)
+		init.history[h] = INIT_BALANCE;
+	init.checksum = init.balance;
+
+#if defined(RECORDS_OBJ)
+	records = (tm_obj<record>**)malloc(sizeof(tm_obj<record>*) * num_records);
+	for (int i = 0; i < num_records; i++)
+		records[i] = new tm_obj<record>(init);
+#else
+	tm_sys_init();
+	tm_admission_init(total_threads);
+	records = (record*)malloc(sizeof(record) * num_records);
+	for (int i = 0; i < num_records; i++)
+		records[i] = init;
+#endif
+
+	pthread_t client_th[300];
+	for (unsigned long i = 1; i < total_threads; i++)
+		pthread_create(&client_th[i-1], NULL, th_run, (void*)i);
+
+	th_run(0);
+
+	for (unsigned int i = 0; i < total_threads - 1; i++)
+		pthread_join(client_th[i], NULL);
+
+	unsigned long long totalThroughput = 0;
+	long moved = 0, torn = 0;
+	for (unsigned int i = 0; i < total_threads; i++) {
+		totalThroughput += throughputs[i];
+		moved += transfers[i];
+		torn += inconsistent[i];
+	}
+
+	printf("Throughput = %llu\n", totalThroughput);
+	if (result_path) {
+		char config[256];
+		snprintf(config, sizeof(config), "driver=records records=%d update=%d",
+				num_records, update_pct);
+		if (!result_append(result_path, RECORDS_ENGINE, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+
+	uint64_t sum = 0, updates = 0;
+	long bad = 0;
+	for (int i = 0; i < num_records; i++) {
+#if defined(RECORDS_OBJ)
+		const record *r = &static_cast<obj_box<record> *>(records[i]->current.load())->data;
+#else
+		const record *r = &records[i];
+#endif
+		sum += r->balance;
+		updates += r->updates;
+		if (!record_consistent(r))
+			bad++;
+	}
+
+	printf("sum = %llu, updates = %llu, inconsistent lookups = %ld, torn records = %ld, matched = %d\n",
+			(unsigned long long)sum, (unsigned long long)updates, torn, bad,
+			sum == (uint64_t)INIT_BALANCE * num_records && updates == 2 * (uint64_t)moved &&
+			torn == 0 && bad == 0);
+
+	return 0;
+}
@@ -0,0 +1,249 @@
+#!/bin/sh
+
+rm -rf results
+mkdir results
+# every driver run below with -o appends a record here; see benchcmp at the end
+RECORDS=results/records.tsv
+
+for ITER in `seq 1 10`
+do
+	echo "ITER $ITER"
+
+	for THREAD in 1 2 4 8
+	do
+		echo "THREAD $THREAD"
+		# partitioned and cross-partition mixes on the global and partitioned rings
+		for CROSS in 0 10 50 100
+		do
+			./test_threads -o $RECORDS -c $CROSS $THREAD >> results/ring_${CROSS}_$THREAD
+			./test_threads_part -o $RECORDS -c $CROSS $THREAD >> results/part_${CROSS}_$THREAD
+		done
+	done
+done
+
+# 2x oversubscription: twice as many threads as online cpus
+OVER=$((2 * `nproc`))
+for ITER in `seq 1 10`
+do
+	./test_threads $OVER >> results/ring_over_$OVER
+	./test_threads_part -c 0 $OVER >> results/part_over_$OVER
+done
+
+# 1000-account workload with and without admission control
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8 16 32
+	do
+		./test_threads -a 1000 $THREAD >> results/ring_1000_$THREAD
+		./test_threads_admit -a 1000 $THREAD >> results/admit_1000_$THREAD
+	done
+done
+
+# single transfers: 2-CAS vs per-account locks vs RingSTM vs TL2, uniform and skewed
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for SKEW in 0 50 90
+		do
+			for BANK in kcas lock ring tl2
+			do
+				./bank_$BANK -o $RECORDS -s $SKEW -h 64 $THREAD >> results/bank_${BANK}_${SKEW}_$THREAD
+			done
+			# delegation: the servers come on top of the client threads
+			for SERVERS in 1 2 4
+			do
+				./bank_delegate -o $RECORDS -S $SERVERS -s $SKEW -h 64 $THREAD >> results/bank_delegate${SERVERS}_${SKEW}_$THREAD
+			done
+		done
+		# the original drivers, fixed work, for reference
+		FINE=../../../Assignment2/mincheol_assignment2/test_threads_fine
+		STM=../../../Assignment4/submission/stm_1000000
+		[ -x $FINE ] && $FINE $THREAD >> results/fine_$THREAD
+		[ -x $STM ] && $STM $THREAD >> results/a4stm_$THREAD
+	done
+done
+
+# online dumps: foreground throughput with a dumper running back to back
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		./test_threads -d results/snapshot.bin $THREAD >> results/dump_$THREAD
+	done
+done
+rm -f results/snapshot.bin
+
+# one recorded trace per thread count and skew, replayed by every variant
+for THREAD in 1 2 4 8
+do
+	for SKEW in 0 50 90
+	do
+		TRACE=results/trace_${SKEW}_$THREAD.bin
+		./bank_ring -w $TRACE -n 1000000 -s $SKEW -h 64 $THREAD > /dev/null
+		for ITER in `seq 1 10`
+		do
+			for BANK in kcas lock ring tl2 delegate
+			do
+				./bank_$BANK -r $TRACE >> results/replay_${BANK}_${SKEW}_$THREAD
+			done
+		done
+		rm -f $TRACE
+	done
+done
+
+# building blocks, one CSV per engine build
+for BENCH in microbench microbench_part microbench_tl2
+do
+	./$BENCH -c -t 8 > results/$BENCH.csv
+done
+
+# flag significant slowdowns against a stored run, e.g. a copy of an older records.tsv
+if [ -f baseline.tsv ]
+then
+	./benchcmp baseline.tsv $RECORDS | tee results/benchcmp
+fi
+
+# __transaction_atomic transfers: gcc's libitm against libitm_stm.a on both engines
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for SKEW in 0 90
+		do
+			./bank_itm -o $RECORDS -s $SKEW -h 64 $THREAD >> results/itm_gnu_${SKEW}_$THREAD
+			ITM_ENGINE=ring ./bank_itm_stm -o $RECORDS -s $SKEW -h 64 $THREAD >> results/itm_ring_${SKEW}_$THREAD
+			ITM_ENGINE=tl2 ./bank_itm_stm -o $RECORDS -s $SKEW -h 64 $THREAD >> results/itm_tl2_${SKEW}_$THREAD
+		done
+	done
+done
+
+# a dependent loop run in order on the ring: plain vs parallel_for_speculative
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for CONFLICT in 0 20
+		do
+			./loop -n 200000 -c $CONFLICT -w 50 $THREAD >> results/loop_${CONFLICT}_$THREAD
+		done
+	done
+done
+
+# hot accounts on TL2: speculative against pre-declared, lock-ordered transactions
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for ACCOUNTS in 64 1048576
+		do
+			./test_threads_tl2 -o $RECORDS -a $ACCOUNTS $THREAD >> results/tl2_spec_${ACCOUNTS}_$THREAD
+			./test_threads_tl2 -o $RECORDS -p -a $ACCOUNTS $THREAD >> results/tl2_declared_${ACCOUNTS}_$THREAD
+		done
+	done
+done
+
+# read-mostly records at 0-10% writes: RingSTM, TL2 and the single sequence lock
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for UPDATE in 0 1 5 10
+		do
+			for ENGINE in ring tl2 tml
+			do
+				./readmostly_$ENGINE -o $RECORDS -u $UPDATE $THREAD >> results/readmostly_${ENGINE}_${UPDATE}_$THREAD
+			done
+		done
+	done
+done
+
+# hot-spot transfers with latency percentiles: optimistic engines against strict 2PL
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for HOT in 4 64
+		do
+			for ENGINE in ring tl2 2pl
+			do
+				./bank_$ENGINE -o $RECORDS -l -s 90 -h $HOT $THREAD >> results/hotspot_${ENGINE}_${HOT}_$THREAD
+			done
+		done
+	done
+done
+
+# mixed short/long transactions: TL2 against eager write/write detection
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for LONG in 0 10 50
+		do
+			./test_threads_tl2 -o $RECORDS -a 1024 -l $LONG $THREAD >> results/mixed_tl2_${LONG}_$THREAD
+			./test_threads_swiss -o $RECORDS -a 1024 -l $LONG $THREAD >> results/mixed_swiss_${LONG}_$THREAD
+		done
+	done
+done
+
+# whole-record transfers: word-level engines against object clones
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for ENGINE in ring tl2 obj
+		do
+			./records_$ENGINE -o $RECORDS $THREAD >> results/records_${ENGINE}_$THREAD
+			./records_$ENGINE -o $RECORDS -u 50 $THREAD >> results/records_lookup_${ENGINE}_$THREAD
+		done
+	done
+done
+
+# intset searches: plain reads, early release and elastic windows
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for MODE in tx release elastic
+		do
+			./intset_tl2 -o $RECORDS -s list -r 1024 -m $MODE $THREAD >> results/intset_list_${MODE}_$THREAD
+			./intset_tl2 -o $RECORDS -s skip -r 65536 -m $MODE $THREAD >> results/intset_skip_${MODE}_$THREAD
+		done
+	done
+done
+
+# hash map: word-level transactions against boosted per-key locks
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for ENGINE in ring tl2 boost
+		do
+			./hashmap_$ENGINE -o $RECORDS $THREAD >> results/hashmap_${ENGINE}_$THREAD
+			./hashmap_$ENGINE -o $RECORDS -b 16 -n 8 $THREAD >> results/hashmap_crowded_${ENGINE}_$THREAD
+		done
+	done
+done
+
+# bank audits (full-table sums) mixed with transfers: serializable vs SI
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		./bank_tl2 -o $RECORDS -a 1024 -A 10 -W 1024 $THREAD >> results/audit_tl2_$THREAD
+		./bank_tl2 -o $RECORDS -a 1024 -A 10 -W 1024 -i $THREAD >> results/audit_tl2_si_$THREAD
+	done
+done
+
+# account layouts (-DBANK_LAYOUT): the lock bank split, packed and padded,
+# and TL2 with one account per line
+for ITER in `seq 1 10`
+do
+	for THREAD in 1 2 4 8
+	do
+		for BANK in lock lock_split lock_padded tl2 tl2_padded
+		do
+			./bank_$BANK -o $RECORDS -s 90 -h 64 $THREAD >> results/layout_${BANK}_$THREAD
+		done
+	done
+done
@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "tm/stats.hpp"
+
+/**
+ *  stmtop: watch the live statistics of a running STM process.
+ *
+ *  Maps /dev/shm/stm_stats.<pid> read-only and prints, every interval,
+ *  the per-thread commit and abort rates (aborts split by cause), the ring
+ *  lag seen at the last validation, the retries of the transaction in
+ *  flight and how long it has been running. Without a pid it lists the
+ *  segments it can find.
+ *
+ *  A process killed by a signal never clears its live flag, so stmtop
+ *  also checks that the pid still exists, and removes the segment of one
+ *  that is gone.
+ */
+
+#define SHM_DIR "/dev/shm"
+
+static void list_segments()
+{
+	DIR *dir = opendir(SHM_DIR);
+	struct dirent *ent;
+	int found = 0;
+
+	if (!dir) {
+		perror(SHM_DIR);
+		return;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		int pid;
+		if (sscanf(ent->d_name, "stm_stats.%d", &pid) == 1) {
+			printf("%d\n", pid);
+			found++;
+		}
+	}
+	closedir(dir);
+	if (!found)
+		printf("no STM processes found\n");
+}
+
+static tm_stats_segment *map_segment(int pid)
+{
+	char name[64];
+	int fd;
+	void *mem;
+
+	snprintf(name, sizeof(name), STATS_NAME_FMT, pid);
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		perror(name);
+		return NULL;
+	}
+	mem = mmap(NULL, sizeof(tm_stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	tm_stats_segment *seg = (tm_stats_segment *)mem;
+	if (seg->magic != STATS_MAGIC || seg->version != STATS_VERSION) {
+		fprintf(stderr, "%s: not a stats segment of this version\n", name);
+		munmap(mem, sizeof(tm_stats_segment));
+		return NULL;
+	}
+	return seg;
+}
+
+struct sample
+{
+	uint64_t commits;
+	uint64_t aborts[ABORT_CAUSES];
+};
+
+static void take(tm_stats_segment *seg, int n, struct sample *s)
+{
+	for (int i = 0; i < n; i++) {
+		s[i].commits = seg->threads[i].commits.load(std::memory_order_relaxed);
+		for (int c = 0; c < ABORT_CAUSES; c++)
+			s[i].aborts[c] = seg->threads[i].aborts[c].load(std::memory_order_relaxed);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		printf("Usage stmtop [pid] [interval_ms]\n");
+		list_segments();
+		return 0;
+	}
+
+	int pid = atoi(argv[1]);
+	int interval = argc > 2 ? atoi(argv[2]) : 1000;
+	if (interval < 10)
+		interval = 10;
+
+	tm_stats_segment *seg = map_segment(pid);
+	if (!seg)
+		return 1;
+
+	static struct sample prev[STATS_MAX_THREADS], cur[STATS_MAX_THREADS];
+	int n = 0;
+	uint64_t then = tm_stats_now();
+	bool died = false;
+
+	while (seg->live.load(std::memory_order_acquire)) {
+		if (kill(pid, 0) != 0 && errno == ESRCH) {
+			died = true;
+			break;
+		}
+
+		int now_n = seg->nthreads.load(std::memory_order_acquire);
+		if (now_n > STATS_MAX_THREADS)
+			now_n = STATS_MAX_THREADS;
+		if (now_n > n) {
+			take(seg, now_n, prev);
+			then = tm_stats_now();
+			n = now_n;
+		}
+
+		usleep(interval * 1000);
+		take(seg, n, cur);
+		uint64_t now = tm_stats_now();
+		double secs = (now - then) / 1e9;
+		then = now;
+
+		printf("\npid %d, %d threads\n", pid, n);
+		printf("%6s %12s %12s %12s %12s %12s %8s %8s %10s\n", "thread", "commits/s",
+				"conflict/s", "locked/s", "overrun/s", "explicit/s", "lag", "retries", "tx us");
+
+		double total_c = 0, total_a[ABORT_CAUSES] = { 0 };
+		for (int i = 0; i < n; i++) {
+			tm_thread_stats *t = &seg->threads[i];
+			double c = (cur[i].commits - prev[i].commits) / secs;
+			double a[ABORT_CAUSES];
+			for (int k = 0; k < ABORT_CAUSES; k++) {
+				a[k] = (cur[i].aborts[k] - prev[i].aborts[k]) / secs;
+				total_a[k] += a[k];
+			}
+			total_c += c;
+
+			uint64_t start = t->tx_start_ns.load(std::memory_order_relaxed);
+			double running = start && now > start ? (now - start) / 1000.0 : 0;
+
+			printf("%6d %12.0f %12.0f %12.0f %12.0f %12.0f %8llu %8llu %10.1f\n",
+					t->id.load(std::memory_order_relaxed), c,
+					a[ABORT_CONFLICT], a[ABORT_LOCKED], a[ABORT_OVERRUN], a[ABORT_EXPLICIT],
+					(unsigned long long)t->ring_lag.load(std::memory_order_relaxed),
+					(unsigned long long)t->retries.load(std::memory_order_relaxed), running);
+		}
+		printf("%6s %12.0f %12.0f %12.0f %12.0f %12.0f\n", "total", total_c,
+				total_a[ABORT_CONFLICT], total_a[ABORT_LOCKED],
+				total_a[ABORT_OVERRUN], total_a[ABORT_EXPLICIT]);
+		fflush(stdout);
+
+		memcpy(prev, cur, sizeof(struct sample) * n);
+	}
+
+	munmap(seg, sizeof(tm_stats_segment));
+	if (died) {
+		char name[64];
+
+		snprintf(name, sizeof(name), STATS_NAME_FMT, pid);
+		shm_unlink(name);
+		printf("process %d died\n", pid);
+	} else {
+		printf("process %d exited\n", pid);
+	}
+	return 0;
+}
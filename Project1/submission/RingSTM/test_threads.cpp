@@ -1,4 +1,4 @@
-#include "tm/ring_stm.hpp"
+#include "tm/tm.hpp"
 #include <pthread.h>
 #include <signal.h>
 #include <pthread.h>
@@ -11,24 +11,40 @@
 #include <sys/sem.h>
 
 #include "tm/rand_r_32.h"
+#include "tm/verify.hpp"
+#include "tm/results.hpp"
 
 #include <errno.h>
+#include <getopt.h>
 
 uint64_t* accountsAll;
 #define ACCOUT_NUM 1048576
+#define INIT_BALANCE 100
 
 unsigned int total_threads;
+int num_accounts = ACCOUT_NUM;
+int cross_pct = -1;		/* -1: uniform accounts, else % of cross-partition txs */
+const char *dump_path = NULL;	/* dump the accounts here during the run */
+const char *result_path = NULL;	/* append a result record here */
+bool declared = false;		/* name the accounts up front (TL2 only) */
+int long_pct = 0;		/* % of transactions that move LONG_PAIRS pairs */
+#define SHORT_PAIRS 10
+#define LONG_PAIRS 100
+pthread_t dump_th;
 /**
  *  Support a few lightweight barriers
  */
 void
 barrier(uint32_t which)
 {
-    static volatile uint32_t barriers[16] = {0};
-    CFENCE;
-    __sync_fetch_and_add(&barriers[which], 1);
-    while (barriers[which] != total_threads) { }
-    CFENCE;
+    static std::atomic<uint32_t> barriers[16];
+    tm_waiter w;
+    uint32_t arrived;
+    barriers[which].fetch_add(1, std::memory_order_acq_rel);
+    tm_wake(&barriers[which]);
+    tm_wait_reset(&w);
+    while ((arrived = barriers[which].load(std::memory_order_acquire)) != total_threads)
+        tm_wait(&w, &barriers[which], arrived);
 }
 
 void
@@ -38,14 +54,44 @@ signal_callback_handler(int signum)
    exit(signum);
 }
 
-volatile bool ExperimentInProgress = true;
+std::atomic<bool> ExperimentInProgress(true);
 static void catch_SIGALRM(int sig_num)
 {
-    ExperimentInProgress = false;
+    ExperimentInProgress.store(false, std::memory_order_relaxed);
 }
 
 unsigned long long throughputs[300];
 
+#if defined(TM_SNAPSHOT_HPP)
+/* Dumps the accounts back to back until the run ends */
+void* dump_run(void * args)
+{
+	snapshot_report r;
+	unsigned long long bytes = 0, nsec = 0;
+	long cow = 0;
+	int dumps = 0, inconsistent = 0;
+	uint64_t expect = (uint64_t)INIT_BALANCE * num_accounts;
+
+	while (ExperimentInProgress.load(std::memory_order_relaxed)) {
+		if (!tm_snapshot_dump(dump_path, &r)) {
+			perror(dump_path);
+			break;
+		}
+		dumps++;
+		bytes += r.bytes;
+		nsec += r.nsec;
+		cow += r.cow_stripes;
+		if (r.checksum != expect)
+			inconsistent++;
+	}
+	printf("dumps = %d, %.1f MB/s, cow stripes = %ld, inconsistent = %d\n", dumps,
+			nsec ? bytes * 1000.0 / nsec : 0.0, cow, inconsistent);
+	return 0;
+}
+#endif
+uint64_t final_sums[300];
+long changed_counts[300];
+
 void* th_run(void * args)
 {
 	int id = ((long)args);
@@ -54,30 +100,69 @@ void* th_run(void * args)
 
     thread_init(id);
 
+	/* first touch: each thread initializes the accounts it is closest to */
+	long lo, hi;
+	thread_slice(id, total_threads, num_accounts, &lo, &hi);
+	fill_slice(accounts, lo, hi, INIT_BALANCE);
+
     barrier(0);
 	unsigned int seed = id;
 
 	if (id == 0) {
 		signal(SIGALRM, catch_SIGALRM);
 		alarm(1);
+#if defined(TM_SNAPSHOT_HPP)
+		if (dump_path)
+			pthread_create(&dump_th, NULL, dump_run, NULL);
+#endif
 	}
 
 	unsigned long long time = get_real_time();
 	int tx_count = 0;
-	while(ExperimentInProgress) {
+	while(ExperimentInProgress.load(std::memory_order_relaxed)) {
 		int acc1[1000];
 
 		int acc2[1000];
-		for (int j=0; j< 10; j++) {
-//				acc1[j] = (ACCOUT_NUM/total_threads)*id + rand_r_32(&seed) % (ACCOUT_NUM/total_threads);
-//				acc2[j] = (ACCOUT_NUM/total_threads)*id + rand_r_32(&seed) % (ACCOUT_NUM/total_threads);
-				acc1[j] = rand_r_32(&seed) % ACCOUT_NUM;
-				acc2[j] = rand_r_32(&seed) % ACCOUT_NUM;
+		int pairs = SHORT_PAIRS;
+		if (long_pct && (int)(rand_r_32(&seed) % 100) < long_pct)
+			pairs = LONG_PAIRS;
+		if (cross_pct < 0) {
+			for (int j=0; j< pairs; j++) {
+				acc1[j] = rand_r_32(&seed) % num_accounts;
+				acc2[j] = rand_r_32(&seed) % num_accounts;
+			}
+		} else {
+			/* each thread owns a slice, cross txs also hit another slice */
+			int other = id;
+			long other_lo, other_hi;
+			if (total_threads > 1 && (int)(rand_r_32(&seed) % 100) < cross_pct)
+				other = (id + 1 + rand_r_32(&seed) % (total_threads - 1)) % total_threads;
+			thread_slice(other, total_threads, num_accounts, &other_lo, &other_hi);
+			for (int j=0; j< pairs; j++) {
+				acc1[j] = lo + rand_r_32(&seed) % (hi - lo);
+				acc2[j] = other_lo + rand_r_32(&seed) % (other_hi - other_lo);
+			}
 		}
 
 		tx_count++;
+#if defined(TM_DECLARED_HPP)
+		if (declared) {
+			TM_BEGIN_DECLARED
+				for (int j=0; j< pairs; j++) {
+					TM_DECLARE_WRITE(accounts[acc1[j]]);
+					TM_DECLARE_WRITE(accounts[acc2[j]]);
+				}
+			TM_RUN_DECLARED
+				for (int j=0; j< pairs; j++) {
+					TM_WRITE(accounts[acc1[j]], (TM_READ(accounts[acc1[j]]) + 50));
+					TM_WRITE(accounts[acc2[j]], (TM_READ(accounts[acc2[j]]) - 50));
+				}
+			TM_END_DECLARED
+			continue;
+		}
+#endif
 		TM_BEGIN
-			for (int j=0; j< 10; j++) {
+			for (int j=0; j< pairs; j++) {
 				TM_WRITE(accounts[acc1[j]], (TM_READ(accounts[acc1[j]]) + 50));
 				TM_WRITE(accounts[acc2[j]], (TM_READ(accounts[acc2[j]]) - 50));
 			}
@@ -87,6 +172,10 @@ void* th_run(void * args)
     throughputs[id] = (1000000000LL * tx_count) / (time);
     TM_TX_VAR
 	printf("%d: commits = %ld, aborts = %ld\n", id, tx->commits, tx->aborts);
+
+	/* every transaction has committed once all threads are past this */
+	barrier(1);
+	final_sums[id] = sum_slice(accounts, lo, hi, INIT_BALANCE, &changed_counts[id]);
 	return 0;
 }
 
@@ -96,23 +185,66 @@ int main(int argc, char* argv[])
 
 	tm_sys_init();
 
-	if (argc < 2) {
-		printf("Usage test threads#\n");
+	int opt;
+	while ((opt = getopt(argc, argv, "a:c:d:o:pl:")) != -1) {
+		switch (opt) {
+		case 'a':
+			num_accounts = atoi(optarg);
+			break;
+		case 'c':
+			cross_pct = atoi(optarg);
+			break;
+		case 'd':
+			dump_path = optarg;
+			break;
+		case 'o':
+			result_path = optarg;
+			break;
+		case 'p':
+			declared = true;
+			break;
+		case 'l':
+			long_pct = atoi(optarg);
+			break;
+		default:
+			optind = argc;
+			break;
+		}
+	}
+
+	if (optind >= argc || num_accounts < 1) {
+		printf("Usage test [-a accounts] [-c cross-partition %%] [-d dump file] [-o result file] [-p] [-l long %%] threads#\n");
 		exit(0);
 	}
 
-    int th_per_zone = atoi(argv[1]);
+    int th_per_zone = atoi(argv[optind]);
 	total_threads = th_per_zone? th_per_zone : 1;
+	if (cross_pct >= 0 && (unsigned int)num_accounts < total_threads) {
+		printf("-c needs at least one account per thread\n");
+		exit(0);
+	}
+	tm_admission_init(total_threads);
 
-	accountsAll = (uint64_t*) malloc(sizeof(uint64_t) * ACCOUT_NUM);
+	accountsAll = alloc_accounts(num_accounts);
+#if defined(RING_PARTITIONED)
+	tm_partition_range(accountsAll, sizeof(uint64_t) * num_accounts);
+#endif
+#if defined(TM_SNAPSHOT_HPP)
+	if (dump_path)
+		tm_snapshot_init(accountsAll, sizeof(uint64_t) * num_accounts);
+#else
+	if (dump_path)
+		printf("online dumps need the global RingSTM, ignoring -d\n");
+	dump_path = NULL;
+#endif
+#if !defined(TM_DECLARED_HPP)
+	if (declared)
+		printf("declared transactions need TL2, ignoring -p\n");
+	declared = false;
+#endif
 
-	long initSum = 0;
-	for (int i=0; i<ACCOUT_NUM; i++) {
-		accountsAll[i] = 100;
-	}
-	for (int i=0; i<ACCOUT_NUM; i++) {
-		initSum += accountsAll[i];
-	}
+	/* the workers fill the accounts in parallel */
+	long initSum = (long)INIT_BALANCE * num_accounts;
 	printf("init sum = %ld\n", initSum);
 
 	pthread_attr_t thread_attr;
@@ -130,6 +262,8 @@ int main(int argc, char* argv[])
 	for (int i=0; i<ids-1; i++) {
 		pthread_join(client_th[i], NULL);
 	}
+	if (dump_path)
+		pthread_join(dump_th, NULL);
 
 	unsigned long long totalThroughput = 0;
 	for (unsigned int i=0; i<total_threads; i++) {
@@ -137,17 +271,40 @@ int main(int argc, char* argv[])
 	}
 
 	printf("\nThroughput = %llu\n", totalThroughput);
+	if (result_path) {
+		char config[256];
+		snprintf(config, sizeof(config), "driver=test_threads accounts=%d cross=%d dump=%d declared=%d long=%d%s%s",
+				num_accounts, cross_pct, dump_path != NULL, declared, long_pct,
+#if defined(TM_ADMISSION)
+				" admission",
+#else
+				"",
+#endif
+#if defined(TM_PROFILE)
+				" profile"
+#else
+				""
+#endif
+				);
+		if (!result_append(result_path, TM_ENGINE_NAME, config, total_threads,
+				totalThroughput, throughputs))
+			perror(result_path);
+	}
+#if defined(TM_ADMISSION)
+	printf("admission limit = %d\n", tm_admission_limit());
+#endif
+#if defined(TM_PROFILE)
+	tm_prof_report(stdout);
+#endif
 
 	long sum = 0;
-	int c=0;
-	for (int i=0; i<ACCOUT_NUM; i++) {
-		sum += accountsAll[i];
-		if (accountsAll[i] != 100) {
-			c++;
-		}
+	long c = 0;
+	for (unsigned int i=0; i<total_threads; i++) {
+		sum += final_sums[i];
+		c += changed_counts[i];
 	}
 
-	printf("\nsum = %ld, matched = %d, changed %d\n", sum, sum == initSum, c);
+	printf("\nsum = %ld, matched = %d, changed %ld\n", sum, sum == initSum, c);
 
 	return 0;
 }
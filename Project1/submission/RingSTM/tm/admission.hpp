@@ -0,0 +1,185 @@
+#ifndef TM_ADMISSION_HPP
+#define TM_ADMISSION_HPP 1
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include "wait.hpp"
+
+/**
+ *  Admission control for the engines (build with -DTM_ADMISSION).
+ *
+ *  A transaction takes a token in TM_BEGIN, keeps it across its retries,
+ *  and gives it back in TM_END, so at most `limit` transactions run at
+ *  once. Every ADMISSION_BATCH transactions a thread folds the growth of
+ *  its commits/aborts counters into the global totals; once per
+ *  ADMISSION_EPOCH_NS one thread turns them into a commit rate and moves
+ *  the limit one step (hill climbing). The first step is a quarter of the
+ *  range; whenever the rate drops the direction reverses and the step
+ *  halves, down to one. Without -DTM_ADMISSION the hooks compile to
+ *  nothing.
+ */
+
+#define ADMISSION_BATCH		64		/* txs between counter flushes */
+#define ADMISSION_EPOCH_NS	10000000ULL	/* 10ms between limit updates */
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES 64
+#endif
+
+struct admission_ctl
+{
+	std::atomic<int> tokens;			/* free slots, may dip below 0 */
+	char pad1[CACHELINE_BYTES - sizeof(std::atomic<int>)];
+	std::atomic<long> commits;			/* flushed by the threads */
+	std::atomic<long> aborts;
+	char pad2[CACHELINE_BYTES - 2 * sizeof(std::atomic<long>)];
+	std::atomic<unsigned long long> epoch_start;	/* owner of the next update */
+	int limit;					/* current concurrency limit */
+	int max;					/* never admit more than this */
+	int step;					/* signed size of the next move */
+	long last_commits;
+	long last_aborts;
+	double last_rate;				/* commits per second */
+};
+
+struct admission_thread
+{
+	long commits_seen;
+	long aborts_seen;
+	unsigned int count;
+};
+
+inline admission_ctl& tm_admission()
+{
+	static admission_ctl ctl;
+	return ctl;
+}
+
+inline admission_thread& tm_admission_self()
+{
+	static __thread admission_thread self;
+	return self;
+}
+
+FORCE_INLINE unsigned long long admission_now()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+#if defined(TM_ADMISSION)
+
+/* Starts with every thread admitted and climbs down from there */
+inline void tm_admission_init(int max_threads)
+{
+	admission_ctl& ctl = tm_admission();
+
+	ctl.max = max_threads > 0 ? max_threads : 1;
+	ctl.limit = ctl.max;
+	ctl.step = -(ctl.max / 4 > 1 ? ctl.max / 4 : 1);
+	ctl.last_commits = 0;
+	ctl.last_aborts = 0;
+	ctl.last_rate = 0;
+	ctl.commits.store(0, std::memory_order_relaxed);
+	ctl.aborts.store(0, std::memory_order_relaxed);
+	ctl.epoch_start.store(admission_now(), std::memory_order_relaxed);
+	ctl.tokens.store(ctl.limit, std::memory_order_release);
+}
+
+inline int tm_admission_limit()
+{
+	return tm_admission().limit;
+}
+
+FORCE_INLINE void tm_admit()
+{
+	admission_ctl& ctl = tm_admission();
+	tm_waiter w;
+	int free;
+
+	tm_wait_reset(&w);
+	for (;;) {
+		free = ctl.tokens.load(std::memory_order_relaxed);
+		if (free > 0 && ctl.tokens.compare_exchange_weak(free, free - 1,
+				std::memory_order_acquire, std::memory_order_relaxed))
+			return;
+		tm_wait(&w, &ctl.tokens, (uint32_t)free);
+	}
+}
+
+/* Runs once per epoch, by whichever thread claimed it */
+inline void tm_admission_adjust(unsigned long long now, unsigned long long start)
+{
+	admission_ctl& ctl = tm_admission();
+	long commits = ctl.commits.load(std::memory_order_relaxed);
+	long aborts = ctl.aborts.load(std::memory_order_relaxed);
+	double rate = (commits - ctl.last_commits) * 1e9 / (double)(now - start);
+	int reverse = ctl.step > 0 ? -1 : 1;
+
+	if (rate < ctl.last_rate) {
+		ctl.step = -ctl.step / 2;
+		if (ctl.step == 0)
+			ctl.step = reverse;
+	} else if (ctl.step > 0 && aborts - ctl.last_aborts > commits - ctl.last_commits) {
+		/* more attempts wasted than committed: don't climb further */
+		ctl.step = -1;
+	}
+
+	int limit = ctl.limit + ctl.step;
+	if (limit < 1)
+		limit = 1;
+	if (limit > ctl.max)
+		limit = ctl.max;
+
+	if (limit != ctl.limit) {
+		ctl.tokens.fetch_add(limit - ctl.limit, std::memory_order_release);
+		tm_wake(&ctl.tokens);
+		ctl.limit = limit;
+	}
+
+	ctl.last_commits = commits;
+	ctl.last_aborts = aborts;
+	ctl.last_rate = rate;
+}
+
+FORCE_INLINE void tm_admission_leave(long commits, long aborts)
+{
+	admission_ctl& ctl = tm_admission();
+	admission_thread& self = tm_admission_self();
+
+	ctl.tokens.fetch_add(1, std::memory_order_release);
+	tm_wake(&ctl.tokens);
+
+	if (++self.count < ADMISSION_BATCH)
+		return;
+
+	self.count = 0;
+	ctl.commits.fetch_add(commits - self.commits_seen, std::memory_order_relaxed);
+	ctl.aborts.fetch_add(aborts - self.aborts_seen, std::memory_order_relaxed);
+	self.commits_seen = commits;
+	self.aborts_seen = aborts;
+
+	unsigned long long now = admission_now();
+	unsigned long long start = ctl.epoch_start.load(std::memory_order_relaxed);
+	if (now - start >= ADMISSION_EPOCH_NS &&
+			ctl.epoch_start.compare_exchange_strong(start, now, std::memory_order_acq_rel))
+		tm_admission_adjust(now, start);
+}
+
+#define TM_ADMIT()		tm_admit();
+#define TM_LEAVE(tx)	tm_admission_leave((tx)->commits, (tx)->aborts);
+
+#else
+
+inline void tm_admission_init(int max_threads) { }
+inline int tm_admission_limit() { return -1; }
+
+#define TM_ADMIT()
+#define TM_LEAVE(tx)
+
+#endif
+
+#endif //TM_ADMISSION_HPP
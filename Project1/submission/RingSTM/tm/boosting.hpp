@@ -0,0 +1,202 @@
+#ifndef TM_BOOSTING_HPP
+#define TM_BOOSTING_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <atomic>
+#include "wait.hpp"
+#include "cmap.hpp"
+
+/**
+ *  Transactional boosting (Herlihy and Koskinen): transactions made of
+ *  whole operations on a linearizable object instead of memory words.
+ *
+ *  Before an operation on key k, a transaction takes the abstract lock of
+ *  k. Operations on different keys commute, so they run side by side
+ *  whatever buckets or words they share underneath. The operation then
+ *  runs at once on the concurrent object (here a cmap, tm/cmap.hpp). If
+ *  it changed anything, its inverse goes on an undo log: an insert is
+ *  undone by a remove, and a remove by inserting the old value again.
+ *  Commit drops the abstract locks. Abort replays the log backwards and
+ *  then drops them.
+ *
+ *  Abstract locks are exclusive, reentrant, and held to the end, so
+ *  boosted transactions are serializable. They are hashed into a table
+ *  of BOOST_LOCKS words, and two keys that share a word are serialized
+ *  for nothing. A transaction that waits BOOST_TIMEOUT_NS for a lock
+ *  takes it as a deadlock. It aborts and backs off (tm_backoff()) before
+ *  retrying, as in tpl_stm.hpp.
+ */
+
+#define BOOST_LOCKS		65536		/* abstract lock words */
+#define BOOST_ACCESS_SIZE	4096		/* locks and undo entries per tx */
+#ifndef BOOST_TIMEOUT_NS
+#define BOOST_TIMEOUT_NS	100000		/* a wait this long is a deadlock */
+#endif
+
+/* An inverse operation, run on abort */
+struct boost_undo
+{
+	void (*fn)(void *obj, uint64_t a, uint64_t b);
+	void *obj;
+	uint64_t a, b;
+};
+
+struct boost_tx
+{
+	int id;
+	jmp_buf scope;
+	int held_pos;
+	uint32_t held[BOOST_ACCESS_SIZE];		/* abstract locks we own */
+	int undo_pos;
+	boost_undo undo[BOOST_ACCESS_SIZE];
+	unsigned int seed;				/* for the backoff */
+	int backoff;
+	long commits, aborts;
+};
+
+inline std::atomic<uint32_t> *boost_locks()
+{
+	static std::atomic<uint32_t> locks[BOOST_LOCKS];	/* owner id + 1 */
+	return locks;
+}
+
+inline boost_tx*& boost_self()
+{
+	static __thread boost_tx *self;
+	return self;
+}
+
+/* Call before a thread's first transaction; ids must be unique */
+inline void boost_thread_init(int id)
+{
+	if (boost_self())
+		return;
+
+	boost_tx *tx = new boost_tx();
+
+	tx->id = id;
+	tx->seed = id + 1;
+	boost_self() = tx;
+}
+
+FORCE_INLINE void boost_release(boost_tx *tx)
+{
+	std::atomic<uint32_t> *locks = boost_locks();
+
+	for (int i = 0; i < tx->held_pos; i++)
+		locks[tx->held[i]].store(0, std::memory_order_release);
+	tx->held_pos = 0;
+}
+
+inline void boost_abort(boost_tx *tx)
+{
+	for (int i = tx->undo_pos - 1; i >= 0; i--)
+		tx->undo[i].fn(tx->undo[i].obj, tx->undo[i].a, tx->undo[i].b);
+	boost_release(tx);
+	tx->aborts++;
+	tm_backoff(&tx->backoff, &tx->seed);
+	longjmp(tx->scope, 1);
+}
+
+/* Takes the abstract lock of key, waiting up to BOOST_TIMEOUT_NS */
+FORCE_INLINE void boost_lock(boost_tx *tx, uint64_t key)
+{
+	uint32_t index = cmap_hash(key) % BOOST_LOCKS;
+	std::atomic<uint32_t> *lock = &boost_locks()[index];
+	uint32_t self = tx->id + 1;
+	uint32_t owner = lock->load(std::memory_order_relaxed);
+	tm_poller p;
+
+	if (owner == self)
+		return;
+	tm_poll_reset(&p);
+	for (;;) {
+		if (owner == 0) {
+			if (lock->compare_exchange_weak(owner, self,
+					std::memory_order_acquire, std::memory_order_relaxed))
+				break;
+			continue;
+		}
+		if (!tm_poll_timed(&p, BOOST_TIMEOUT_NS))
+			boost_abort(tx);
+		owner = lock->load(std::memory_order_relaxed);
+	}
+	tx->held[tx->held_pos++] = index;
+}
+
+FORCE_INLINE void boost_on_abort(boost_tx *tx, void (*fn)(void *, uint64_t, uint64_t),
+		void *obj, uint64_t a, uint64_t b)
+{
+	boost_undo *u = &tx->undo[tx->undo_pos++];
+	u->fn = fn;
+	u->obj = obj;
+	u->a = a;
+	u->b = b;
+}
+
+FORCE_INLINE void boost_begin(boost_tx *tx)
+{
+	tx->held_pos = 0;
+	tx->undo_pos = 0;
+}
+
+FORCE_INLINE void boost_commit(boost_tx *tx)
+{
+	boost_release(tx);
+	tx->backoff = 0;
+	tx->commits++;
+}
+
+/* The boosted cmap: an operation and, if it changed the map, its inverse */
+
+inline void cmap_undo_insert(void *m, uint64_t key, uint64_t val)
+{
+	uint64_t old;
+	cmap_remove((cmap *)m, key, &old);
+}
+
+inline void cmap_undo_remove(void *m, uint64_t key, uint64_t val)
+{
+	cmap_insert((cmap *)m, key, val);
+}
+
+FORCE_INLINE bool boosted_lookup(boost_tx *tx, cmap *m, uint64_t key, uint64_t *val)
+{
+	boost_lock(tx, key);
+	return cmap_lookup(m, key, val);
+}
+
+FORCE_INLINE bool boosted_insert(boost_tx *tx, cmap *m, uint64_t key, uint64_t val)
+{
+	boost_lock(tx, key);
+	if (!cmap_insert(m, key, val))
+		return false;
+	boost_on_abort(tx, cmap_undo_insert, m, key, val);
+	return true;
+}
+
+FORCE_INLINE bool boosted_remove(boost_tx *tx, cmap *m, uint64_t key, uint64_t *val)
+{
+	boost_lock(tx, key);
+	if (!cmap_remove(m, key, val))
+		return false;
+	boost_on_abort(tx, cmap_undo_remove, m, key, *val);
+	return true;
+}
+
+#define BOOST_BEGIN						\
+	{							\
+		boost_tx *btx = boost_self();			\
+		_setjmp(btx->scope);				\
+		{						\
+			boost_begin(btx);
+
+#define BOOST_END						\
+			boost_commit(btx);			\
+		}						\
+	}
+
+#endif //TM_BOOSTING_HPP
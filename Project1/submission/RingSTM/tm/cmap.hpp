@@ -0,0 +1,150 @@
+#ifndef TM_CMAP_HPP
+#define TM_CMAP_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <atomic>
+#include "wait.hpp"
+
+/**
+ *  A concurrent, non-transactional hash map from uint64_t keys to values.
+ *
+ *  Every bucket is a chain behind its own test-and-set lock, so two
+ *  operations only contend when their keys hash to the same bucket.
+ *  Operations are linearizable at the bucket lock. A removed node is freed
+ *  at once, since nobody can be inside the bucket without its lock. There
+ *  is no global size, so operations on different buckets share nothing;
+ *  cmap_size() walks the table and is only exact when the map is quiet.
+ *
+ *  A lock that stays busy is polled and then yielded on (tm_poll()), as a
+ *  holder that was preempted needs the cpu back.
+ */
+
+struct cmap_node
+{
+	uint64_t key;
+	uint64_t val;
+	cmap_node *next;
+};
+
+struct cmap_bucket
+{
+	std::atomic<bool> lock;
+	cmap_node *head;
+};
+
+struct cmap
+{
+	uint64_t mask;			/* buckets - 1 */
+	cmap_bucket *buckets;
+};
+
+/* buckets is rounded up to a power of two */
+inline void cmap_init(cmap *m, uint64_t buckets)
+{
+	uint64_t n = 1;
+	while (n < buckets)
+		n <<= 1;
+	m->mask = n - 1;
+	m->buckets = (cmap_bucket *)malloc(sizeof(cmap_bucket) * n);
+	for (uint64_t i = 0; i < n; i++) {
+		m->buckets[i].lock.store(false, std::memory_order_relaxed);
+		m->buckets[i].head = NULL;
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+FORCE_INLINE uint64_t cmap_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return key;
+}
+
+FORCE_INLINE cmap_bucket *cmap_lock(cmap *m, uint64_t key)
+{
+	cmap_bucket *b = &m->buckets[cmap_hash(key) & m->mask];
+
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	while (b->lock.exchange(true, std::memory_order_acquire))
+		while (b->lock.load(std::memory_order_relaxed))
+			tm_poll(&p);
+	return b;
+}
+
+FORCE_INLINE void cmap_unlock(cmap_bucket *b)
+{
+	b->lock.store(false, std::memory_order_release);
+}
+
+inline bool cmap_lookup(cmap *m, uint64_t key, uint64_t *val)
+{
+	cmap_bucket *b = cmap_lock(m, key);
+	bool found = false;
+
+	for (cmap_node *n = b->head; n; n = n->next) {
+		if (n->key == key) {
+			*val = n->val;
+			found = true;
+			break;
+		}
+	}
+	cmap_unlock(b);
+	return found;
+}
+
+/* false if key was already there */
+inline bool cmap_insert(cmap *m, uint64_t key, uint64_t val)
+{
+	cmap_node *fresh = (cmap_node *)malloc(sizeof(cmap_node));
+	cmap_bucket *b = cmap_lock(m, key);
+
+	for (cmap_node *n = b->head; n; n = n->next) {
+		if (n->key == key) {
+			cmap_unlock(b);
+			free(fresh);
+			return false;
+		}
+	}
+	fresh->key = key;
+	fresh->val = val;
+	fresh->next = b->head;
+	b->head = fresh;
+	cmap_unlock(b);
+	return true;
+}
+
+/* false if key was not there; otherwise its value goes to *val */
+inline bool cmap_remove(cmap *m, uint64_t key, uint64_t *val)
+{
+	cmap_bucket *b = cmap_lock(m, key);
+
+	for (cmap_node **p = &b->head; *p; p = &(*p)->next) {
+		cmap_node *n = *p;
+		if (n->key == key) {
+			*p = n->next;
+			cmap_unlock(b);
+			*val = n->val;
+			free(n);
+			return true;
+		}
+	}
+	cmap_unlock(b);
+	return false;
+}
+
+inline uint64_t cmap_size(cmap *m)
+{
+	uint64_t size = 0;
+
+	for (uint64_t i = 0; i <= m->mask; i++)
+		for (cmap_node *n = m->buckets[i].head; n; n = n->next)
+			size++;
+	return size;
+}
+
+#endif //TM_CMAP_HPP
@@ -0,0 +1,158 @@
+#ifndef TM_DECLARED_HPP
+#define TM_DECLARED_HPP 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+
+/**
+ *  Transactions that name their accounts up front (TL2, included by
+ *  tm_thread.hpp).
+ *
+ *	TM_BEGIN_DECLARED
+ *		TM_DECLARE_WRITE(accounts[a]);
+ *		TM_DECLARE_READ(accounts[b]);
+ *	TM_RUN_DECLARED
+ *		... TM_READ / TM_WRITE on the declared words only ...
+ *	TM_END_DECLARED
+ *
+ *  TM_RUN_DECLARED sorts the stripes and locks them in ascending order,
+ *  waiting for each one rather than aborting. Declared transactions
+ *  therefore cannot deadlock among themselves. Speculative commits only
+ *  try their locks and abort on failure, so they never wait on a
+ *  declared one while holding anything. The body then runs in place
+ *  without logging and never aborts. At the end the written stripes get
+ *  a new version and every lock is dropped.
+ *
+ *  The lock table has no shared mode, so a declared read also locks its
+ *  stripe exclusively; only its version is left alone. Touching a word
+ *  that was not declared is a bug and stops the program.
+ */
+
+#define DECL_WRITE	1			/* low bit of a declared key */
+#define DECL_SMALL	32			/* insertion sort up to here */
+
+FORCE_INLINE void tm_declare(Tx_Context* tx, uint64_t* addr, bool write)
+{
+	uint64_t index = (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+	tx->writes[tx->writes_pos++] = index << 1 | (write ? DECL_WRITE : 0);
+}
+
+/* Locks the declared stripes in order; keeps one key per stripe */
+inline void tm_declared_lock(Tx_Context* tx)
+{
+	uint64_t self = tx->id + 1;
+	int n = 0;
+
+	if (tx->writes_pos <= DECL_SMALL) {
+		for (int i = 1; i < tx->writes_pos; i++) {
+			uint64_t key = tx->writes[i];
+			int j = i;
+			for (; j > 0 && tx->writes[j - 1] > key; j--)
+				tx->writes[j] = tx->writes[j - 1];
+			tx->writes[j] = key;
+		}
+	} else {
+		std::sort(tx->writes, tx->writes + tx->writes_pos);
+	}
+	for (int i = 0; i < tx->writes_pos; i++) {
+		uint64_t key = tx->writes[i];
+		if (n && (tx->writes[n - 1] >> 1) == (key >> 1)) {
+			tx->writes[n - 1] |= key;	/* a write wins over a read */
+			continue;
+		}
+		tx->writes[n++] = key;
+
+		lock_entry* entry_p = &(lock_table[key >> 1]);
+		tm_waiter w;
+		uint64_t owner = 0;
+
+		tm_wait_reset(&w);
+		while (!entry_p->lock_owner.compare_exchange_weak(owner, self,
+				std::memory_order_acquire, std::memory_order_relaxed)) {
+			if (owner)
+				tm_wait(&w, &entry_p->lock_owner, (uint32_t)owner);
+			owner = 0;
+		}
+	}
+	/* the lock CASes only acquire; keep the in-place writes behind them */
+	std::atomic_thread_fence(std::memory_order_release);
+	tx->writes_pos = n;
+	tx->declared = true;
+}
+
+inline void tm_declared_check(uint64_t* addr, Tx_Context* tx)
+{
+	uint64_t index = (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+	if (lock_table[index].lock_owner.load(std::memory_order_relaxed) != (uint64_t)(tx->id + 1)) {
+		fprintf(stderr, "thread %d: %p was not declared\n", tx->id, (void *)addr);
+		abort();
+	}
+}
+
+FORCE_INLINE uint64_t tm_declared_read(uint64_t* addr, Tx_Context* tx)
+{
+	tm_declared_check(addr, tx);
+	TM_PROF_READ(tx)
+	return *addr;
+}
+
+FORCE_INLINE void tm_declared_write(uint64_t* addr, uint64_t val, Tx_Context* tx)
+{
+	tm_declared_check(addr, tx);
+	*addr = val;
+}
+
+inline void tm_declared_commit(Tx_Context* tx)
+{
+	/* the RMW orders the in-place writes before the new versions */
+	uintptr_t next_ts = global_clock.val.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+	for (int i = 0; i < tx->writes_pos; i++) {
+		lock_entry* entry_p = &(lock_table[tx->writes[i] >> 1]);
+		if (tx->writes[i] & DECL_WRITE)
+			entry_p->version.store(next_ts, std::memory_order_relaxed);
+		entry_p->lock_owner.store(0, std::memory_order_release);
+		tm_wake(&entry_p->lock_owner);
+	}
+	tx->declared = false;
+	tx->commits++;
+}
+
+/* Stripes declared for writing, for the profile */
+inline int tm_declared_writes(Tx_Context* tx)
+{
+	int n = 0;
+
+	for (int i = 0; i < tx->writes_pos; i++)
+		n += tx->writes[i] & DECL_WRITE;
+	return n;
+}
+
+#define TM_DECLARE_READ(var)	tm_declare(tx, &(var), false)
+#define TM_DECLARE_WRITE(var)	tm_declare(tx, &(var), true)
+
+#define TM_BEGIN_DECLARED					\
+	{							\
+		Tx_Context* tx = (Tx_Context*)Self;		\
+		TM_ADMIT()					\
+		TM_STATS_BEGIN(tx)				\
+		TM_PROF_BEGIN(tx)				\
+		{						\
+			TM_PROF_ATTEMPT(tx)			\
+			tx->writes_pos = 0;
+
+#define TM_RUN_DECLARED						\
+			tm_declared_lock(tx);
+
+#define TM_END_DECLARED						\
+			tm_declared_commit(tx);			\
+			TM_LEAVE(tx)				\
+			TM_STATS_END(tx)			\
+			TM_PROF_COMMIT(tx, tm_declared_writes(tx))	\
+		}						\
+	}
+
+#endif //TM_DECLARED_HPP
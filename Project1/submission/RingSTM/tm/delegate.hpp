@@ -0,0 +1,145 @@
+#ifndef TM_DELEGATE_HPP
+#define TM_DELEGATE_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <atomic>
+#include "wait.hpp"
+
+/**
+ *  ffwd-style delegation: data is owned by server threads, and clients
+ *  never touch it. Instead they ask the owner to run an operation.
+ *
+ *  Every (server, client) pair has one request line and one response
+ *  line, a cache line each. A client fills in the request and bumps its
+ *  sequence number. The server walks its request lines in order, runs the
+ *  handler for every line whose sequence moved, and publishes the result
+ *  with the same sequence number in the response line. Each line has one
+ *  writer, so nothing is ever locked, and the owned data stays in the
+ *  server's cache.
+ *
+ *  A client has at most one outstanding request per server. dlg_call()
+ *  polls for the answer and then yields (tm_poll()). A round trip is short
+ *  when the server has its own cpu. When it does not, only yielding lets
+ *  the server run, so the long backoff of tm_wait() would be the wrong
+ *  tool here.
+ */
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES 64
+#endif
+
+#define DLG_CALL_SPINS	256		/* polls before a client yields */
+
+struct dlg_request
+{
+	std::atomic<uint32_t> seq;		/* bumped by the client to post */
+	uint32_t op;
+	uint64_t arg[3];
+	char pad[CACHELINE_BYTES - 2 * sizeof(uint32_t) - 3 * sizeof(uint64_t)];
+};
+
+struct dlg_response
+{
+	std::atomic<uint32_t> seq;		/* request seq this answers */
+	uint32_t pad0;
+	uint64_t ret;
+	char pad[CACHELINE_BYTES - 2 * sizeof(uint32_t) - sizeof(uint64_t)];
+};
+
+typedef uint64_t (*dlg_handler)(uint32_t op, uint64_t a0, uint64_t a1, uint64_t a2);
+
+struct dlg_system
+{
+	int servers;
+	int clients;
+	dlg_request *req;			/* [server][client] */
+	dlg_response *resp;			/* [server][client] */
+	std::atomic<bool> stop;
+};
+
+inline dlg_system& dlg_state()
+{
+	static dlg_system sys;
+	return sys;
+}
+
+inline void dlg_init(int servers, int clients)
+{
+	dlg_system& sys = dlg_state();
+	size_t lines = (size_t)servers * clients;
+
+	sys.servers = servers;
+	sys.clients = clients;
+	sys.req = (dlg_request *)aligned_alloc(CACHELINE_BYTES, lines * sizeof(dlg_request));
+	sys.resp = (dlg_response *)aligned_alloc(CACHELINE_BYTES, lines * sizeof(dlg_response));
+	for (size_t i = 0; i < lines; i++) {
+		sys.req[i].seq.store(0, std::memory_order_relaxed);
+		sys.resp[i].seq.store(0, std::memory_order_relaxed);
+	}
+	sys.stop.store(false, std::memory_order_release);
+}
+
+/* Runs op on the server that owns the data and returns its result */
+FORCE_INLINE uint64_t dlg_call(int server, int client, uint32_t op,
+		uint64_t a0, uint64_t a1, uint64_t a2)
+{
+	dlg_system& sys = dlg_state();
+	dlg_request *r = &sys.req[server * sys.clients + client];
+	dlg_response *s = &sys.resp[server * sys.clients + client];
+	uint32_t seq = r->seq.load(std::memory_order_relaxed) + 1;
+
+	r->op = op;
+	r->arg[0] = a0;
+	r->arg[1] = a1;
+	r->arg[2] = a2;
+	r->seq.store(seq, std::memory_order_release);
+
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	while (s->seq.load(std::memory_order_acquire) != seq)
+		tm_poll(&p, DLG_CALL_SPINS);
+	return s->ret;
+}
+
+/* Server loop; returns once dlg_stop() is called */
+inline void dlg_serve(int server, dlg_handler handler)
+{
+	dlg_system& sys = dlg_state();
+	dlg_request *req = &sys.req[server * sys.clients];
+	dlg_response *resp = &sys.resp[server * sys.clients];
+	uint32_t *served = (uint32_t *)calloc(sys.clients, sizeof(uint32_t));
+	tm_poller idle;
+
+	tm_poll_reset(&idle);
+
+	while (!sys.stop.load(std::memory_order_relaxed)) {
+		bool found = false;
+
+		for (int c = 0; c < sys.clients; c++) {
+			uint32_t seq = req[c].seq.load(std::memory_order_acquire);
+			if (seq == served[c])
+				continue;
+
+			resp[c].ret = handler(req[c].op, req[c].arg[0], req[c].arg[1], req[c].arg[2]);
+			resp[c].seq.store(seq, std::memory_order_release);
+			served[c] = seq;
+			found = true;
+		}
+
+		if (found)
+			tm_poll_reset(&idle);
+		else
+			tm_poll(&idle);
+	}
+	free(served);
+}
+
+inline void dlg_stop()
+{
+	dlg_state().stop.store(true, std::memory_order_release);
+}
+
+#endif //TM_DELEGATE_HPP
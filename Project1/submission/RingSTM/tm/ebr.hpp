@@ -0,0 +1,137 @@
+#ifndef TM_EBR_HPP
+#define TM_EBR_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+/**
+ *  Epoch-based reclamation, shared by kcas.hpp and object.hpp.
+ *
+ *  A thread announces the global epoch while it may hold shared pointers
+ *  (ebr_enter) and clears it afterwards (ebr_exit). The global epoch only
+ *  advances once every active thread has announced the current one, so a
+ *  thread that announced e holds the epoch below e + 2.
+ *
+ *  Memory unlinked while the global epoch is g goes into the limbo bag of
+ *  g % 3, tagged with g. Whoever could still see it announced g or less.
+ *  The bag is therefore released once the global epoch reaches g + 2. The
+ *  tag has to be the global epoch read at retire time: a thread's own
+ *  announcement may lag behind it, and a helper that entered in the
+ *  newer epoch could still be looking at what it retires.
+ */
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+#define EBR_MAX_THREADS		256
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES 64
+#endif
+
+struct ebr_slot
+{
+	std::atomic<uint64_t> local;		/* epoch << 1 | active */
+	char pad[CACHELINE_BYTES - sizeof(uint64_t)];
+};
+
+struct ebr_domain
+{
+	std::atomic<uint64_t> epoch;
+	char pad1[CACHELINE_BYTES - sizeof(uint64_t)];
+	std::atomic<int> nthreads;		/* highest slot in use + 1 */
+	char pad2[CACHELINE_BYTES - sizeof(int)];
+	ebr_slot slots[EBR_MAX_THREADS];
+};
+
+/* Three bags of retired T, linked through T::next */
+template <typename T>
+struct ebr_limbo
+{
+	T *bag[3];
+	uint64_t tag[3];			/* global epoch of the bag's retires */
+};
+
+/* Slot of thread id; ids must be unique and below EBR_MAX_THREADS */
+inline ebr_slot *ebr_register(ebr_domain *d, int id)
+{
+	if (id < 0 || id >= EBR_MAX_THREADS) {
+		fprintf(stderr, "thread id %d is out of range, max %d threads\n", id, EBR_MAX_THREADS);
+		abort();
+	}
+
+	int n = d->nthreads.load(std::memory_order_relaxed);
+	d->slots[id].local.store(0, std::memory_order_relaxed);
+	while (n <= id && !d->nthreads.compare_exchange_weak(n, id + 1, std::memory_order_acq_rel))
+		;
+	return &d->slots[id];
+}
+
+/* Announces the current epoch and returns it */
+FORCE_INLINE uint64_t ebr_enter(ebr_domain *d, ebr_slot *s)
+{
+	uint64_t now = d->epoch.load(std::memory_order_acquire);
+
+	/* announce before touching shared memory */
+	s->local.store(now << 1 | 1, std::memory_order_seq_cst);
+	return now;
+}
+
+FORCE_INLINE void ebr_exit(ebr_slot *s)
+{
+	s->local.store(0, std::memory_order_release);
+}
+
+/* Advances the epoch if every active thread has seen the current one */
+inline void ebr_try_advance(ebr_domain *d)
+{
+	uint64_t now = d->epoch.load(std::memory_order_acquire);
+	int n = d->nthreads.load(std::memory_order_acquire);
+
+	for (int i = 0; i < n; i++) {
+		uint64_t local = d->slots[i].local.load(std::memory_order_acquire);
+		if ((local & 1) && (local >> 1) != now)
+			return;
+	}
+	d->epoch.compare_exchange_strong(now, now + 1, std::memory_order_acq_rel);
+}
+
+/* Hands bag i to release, one node at a time */
+template <typename T, typename F>
+FORCE_INLINE void ebr_drain(ebr_limbo<T> *l, int i, F release)
+{
+	while (T *p = l->bag[i]) {
+		l->bag[i] = p->next;
+		release(p);
+	}
+}
+
+/* Releases every bag retired two epochs or more before now */
+template <typename T, typename F>
+inline void ebr_reclaim(ebr_limbo<T> *l, uint64_t now, F release)
+{
+	for (int i = 0; i < 3; i++)
+		if (l->bag[i] && now >= l->tag[i] + 2)
+			ebr_drain(l, i, release);
+}
+
+/* Files p under the current global epoch */
+template <typename T, typename F>
+FORCE_INLINE void ebr_retire(ebr_domain *d, ebr_limbo<T> *l, T *p, F release)
+{
+	uint64_t now = d->epoch.load(std::memory_order_acquire);
+	int i = now % 3;
+
+	/* a bag with another tag is at least three epochs old */
+	if (l->tag[i] != now) {
+		ebr_drain(l, i, release);
+		l->tag[i] = now;
+	}
+	p->next = l->bag[i];
+	l->bag[i] = p;
+}
+
+#endif //TM_EBR_HPP
@@ -0,0 +1,116 @@
+#ifndef TM_ELASTIC_HPP
+#define TM_ELASTIC_HPP 1
+
+#include <stdint.h>
+#include <atomic>
+
+/**
+ *  Early release and elastic transactions for searches (TL2, included by
+ *  tm_thread.hpp).
+ *
+ *  TM_RELEASE(var) drops the stripe of var from the read set, so commit
+ *  no longer validates it. A traversal releases the nodes it has moved
+ *  past, and an insert behind the cursor stops aborting it. Release works
+ *  on stripes: a word that shares one with var is released too.
+ *
+ *  TM_ELASTIC, right after TM_BEGIN, starts an elastic search. Its reads
+ *  are not logged and need not be older than the start. A read only
+ *  checks that the last ELASTIC_WINDOW reads are unchanged, so the
+ *  search sees a consistent window that slides along the structure.
+ *  While the clock has not moved it skips even that. The first write, or
+ *  TM_SETTLE, ends the search. The window becomes the read set and the
+ *  start moves to the current clock. From then on the transaction is
+ *  ordinary TL2. Code that relies on reads older than the window must
+ *  read them again after TM_SETTLE.
+ *
+ *  The RingSTM engines keep their read sets as signatures, which cannot
+ *  delete entries, so both features are TL2 only.
+ */
+
+FORCE_INLINE void tm_release(uint64_t* addr, Tx_Context* tx)
+{
+	uint64_t index = (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+
+	/* recent reads are the likely ones; entries past i are checked */
+	for (int i = tx->reads_pos - 1; i >= 0; i--)
+		if (tx->reads[i] == index)
+			tx->reads[i] = tx->reads[--tx->reads_pos];
+}
+
+FORCE_INLINE void tm_elastic_begin(Tx_Context* tx)
+{
+	tx->elastic = true;
+	tx->window_pos = 0;
+	tx->window_time = tx->start_time;
+}
+
+/* The window is unchanged and unlocked */
+FORCE_INLINE bool tm_elastic_valid(Tx_Context* tx)
+{
+	int n = tx->window_pos < ELASTIC_WINDOW ? tx->window_pos : ELASTIC_WINDOW;
+
+	for (int i = 0; i < n; i++) {
+		lock_entry* entry_p = &(lock_table[tx->window_index[i]]);
+		if (entry_p->version.load(std::memory_order_acquire) != tx->window_version[i] ||
+				entry_p->lock_owner.load(std::memory_order_relaxed))
+			return false;
+	}
+	return true;
+}
+
+FORCE_INLINE uint64_t tm_elastic_read(uint64_t* addr, Tx_Context* tx)
+{
+	uint64_t index = (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+	lock_entry* entry_p = &(lock_table[index]);
+	uint64_t v1, val;
+
+	for (;;) {
+		v1 = entry_p->version.load(std::memory_order_acquire);
+		val = *addr;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (entry_p->version.load(std::memory_order_relaxed) == v1 &&
+				!entry_p->lock_owner.load(std::memory_order_relaxed))
+			break;
+
+		/* nothing ties us to the old value: wait for the owner and read again */
+		tm_waiter w;
+		uint64_t owner;
+
+		tm_wait_reset(&w);
+		while ((owner = entry_p->lock_owner.load(std::memory_order_relaxed)) != 0)
+			tm_wait(&w, &entry_p->lock_owner, (uint32_t)owner);
+	}
+	/* a writer bumps the clock before it unlocks, so an unchanged clock
+	 * means nothing we have read was overwritten */
+	uintptr_t now = global_clock.val.load(std::memory_order_acquire);
+	if (now != tx->window_time) {
+		if (!tm_elastic_valid(tx))
+			tm_abort(tx, ABORT_CONFLICT);
+		tx->window_time = now;
+	}
+
+	int slot = tx->window_pos++ % ELASTIC_WINDOW;
+	tx->window_index[slot] = index;
+	tx->window_version[slot] = v1;
+	TM_PROF_READ(tx)
+	return val;
+}
+
+/* Ends the search: the window joins a read set taken from now */
+inline void tm_elastic_settle(Tx_Context* tx)
+{
+	int n = tx->window_pos < ELASTIC_WINDOW ? tx->window_pos : ELASTIC_WINDOW;
+
+	tx->elastic = false;
+	tx->start_time = global_clock.val.load(std::memory_order_acquire);
+	if (!tm_elastic_valid(tx))
+		tm_abort(tx, ABORT_CONFLICT);
+	for (int i = 0; i < n; i++)
+		tx->reads[tx->reads_pos++] = tx->window_index[i];
+}
+
+#define TM_RELEASE(var)	tm_release(&(var), tx)
+#define TM_ELASTIC	tm_elastic_begin(tx);
+#define TM_SETTLE	if (tx->elastic) tm_elastic_settle(tx);
+
+#endif //TM_ELASTIC_HPP
@@ -0,0 +1,760 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <x86intrin.h>
+#include "wait.hpp"
+#include "itm.hpp"
+
+/**
+ *  The GCC libitm ABI (-fgnu-tm, __transaction_atomic) on top of RingSTM
+ *  or TL2. Link a program compiled with -fgnu-tm against libitm_stm.a
+ *  instead of letting gcc add -litm. $ITM_ENGINE picks the engine.
+ *
+ *  _ITM_beginTransaction saves the callee-saved registers, the stack
+ *  pointer and the return address. An abort restores them, so
+ *  _ITM_beginTransaction returns a second time with
+ *  a_restoreLiveVariables. This is a setjmp that outlives the call, which
+ *  the engines' own setjmp in TM_BEGIN cannot be.
+ *
+ *  The engines are word-based and lazy. A narrower or unaligned access
+ *  reads the words it touches through the engine, merges the bytes and
+ *  writes whole words back. Nothing is visible before commit, so an
+ *  abort only has to roll back what the ABI logs itself:
+ *
+ *    - thread-local stores logged with _ITM_L*
+ *    - _ITM_malloc'd blocks, which are freed
+ *    - _ITM_free'd blocks, which are not freed after all
+ *    - user undo actions
+ *
+ *  Nesting is flat. Cancelling an inner transaction on its own is not
+ *  supported and stops the program.
+ *
+ *  Irrevocable mode is serial. The transaction restarts, waits until no
+ *  other transaction is running, and keeps new ones out until it
+ *  commits. It runs the uninstrumented code path when the compiler
+ *  provides one; otherwise the barriers access memory directly. Every
+ *  begin pays for this with one store and one load of the serial word.
+ *
+ *  Exceptions thrown out of a transaction are not supported.
+ */
+
+/* libitm.h, the parts gcc's code uses */
+typedef uint32_t _ITM_transactionId_t;
+typedef void (*_ITM_userUndoFunction)(void *);
+typedef void (*_ITM_userCommitFunction)(void *);
+
+struct _ITM_srcLocation
+{
+	int32_t reserved_1;
+	int32_t flags;
+	int32_t reserved_2;
+	int32_t reserved_3;
+	const char *psource;
+};
+
+enum {
+	pr_instrumentedCode = 0x0001,
+	pr_uninstrumentedCode = 0x0002,
+	pr_hasNoAbort = 0x0008,
+	pr_doesGoIrrevocable = 0x0040,
+};
+
+enum {
+	a_runInstrumentedCode = 0x01,
+	a_runUninstrumentedCode = 0x02,
+	a_saveLiveVariables = 0x04,
+	a_restoreLiveVariables = 0x08,
+	a_abortTransaction = 0x10,
+};
+
+enum { userAbort = 1, userRetry = 2, TMConflict = 4, exceptionBlockAbort = 8, outerAbort = 16 };
+enum { outsideTransaction = 0, inRetryableTransaction, inIrrevocableTransaction };
+enum { modeSerialIrrevocable };
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES		64
+#endif
+
+#define _ITM_VERSION_NO		100
+#define ITM_MAX_THREADS		1024
+#define ITM_CHUNK		256		/* bytes per step of the mem* barriers */
+
+/* what _ITM_beginTransaction saves; offsets are used by the assembly */
+struct itm_jmpbuf
+{
+	uint64_t cfa;				/* stack pointer after the call returns */
+	uint64_t rbx, rbp, r12, r13, r14, r15;
+	uint64_t rip;				/* return address */
+};
+
+struct itm_vec
+{
+	void **v;
+	size_t n, cap;
+};
+
+struct itm_thread
+{
+	std::atomic<int> active;		/* in a revocable transaction */
+	char pad[CACHELINE_BYTES - sizeof(std::atomic<int>)];
+	int id;
+	int depth;				/* flat nesting */
+	bool serial;				/* holds the serial lock */
+	bool want_serial;			/* restart irrevocably */
+	uint32_t props;				/* of the outermost transaction */
+	_ITM_transactionId_t tid;
+	itm_jmpbuf checkpoint;
+	char *undo;				/* _ITM_L* records, see itm_log() */
+	size_t undo_len, undo_cap;
+	itm_vec allocs;				/* freed on abort */
+	itm_vec frees;				/* freed on commit */
+	itm_vec commit_actions;			/* fn, arg pairs */
+	itm_vec undo_actions;
+};
+
+struct itm_undo_footer
+{
+	void *addr;
+	size_t len;
+};
+
+struct itm_clone_table
+{
+	void **pairs;				/* original, clone, original, ... */
+	size_t n;
+	itm_clone_table *next;
+};
+
+static const itm_engine *itm_eng = &itm_ring_engine;
+static __thread itm_thread *itm_self_ptr;
+static itm_thread *itm_threads[ITM_MAX_THREADS];
+static std::atomic<int> itm_nthreads(0);
+static std::atomic<itm_thread *> itm_serial_owner(NULL);
+static std::atomic<_ITM_transactionId_t> itm_next_tid(1);
+static itm_clone_table *itm_clones;
+static pthread_mutex_t itm_clones_lock = PTHREAD_MUTEX_INITIALIZER;
+
+extern "C" uint32_t itm_begin(uint32_t props, const itm_jmpbuf *jb)
+	__attribute__((visibility("hidden"), used));
+extern "C" void itm_longjmp(const itm_jmpbuf *jb, uint32_t action)
+	__attribute__((visibility("hidden"), noreturn));
+
+__asm__(
+	"	.text\n"
+	"	.globl	_ITM_beginTransaction\n"
+	"	.type	_ITM_beginTransaction, @function\n"
+	"_ITM_beginTransaction:\n"
+	"	.cfi_startproc\n"
+	"	leaq	8(%rsp), %rax\n"
+	"	subq	$72, %rsp\n"		/* keeps the call 16-byte aligned */
+	"	.cfi_adjust_cfa_offset 72\n"
+	"	movq	%rax, (%rsp)\n"
+	"	movq	%rbx, 8(%rsp)\n"
+	"	movq	%rbp, 16(%rsp)\n"
+	"	movq	%r12, 24(%rsp)\n"
+	"	movq	%r13, 32(%rsp)\n"
+	"	movq	%r14, 40(%rsp)\n"
+	"	movq	%r15, 48(%rsp)\n"
+	"	movq	72(%rsp), %rax\n"
+	"	movq	%rax, 56(%rsp)\n"
+	"	movq	%rsp, %rsi\n"
+	"	call	itm_begin\n"
+	"	addq	$72, %rsp\n"
+	"	.cfi_adjust_cfa_offset -72\n"
+	"	ret\n"
+	"	.cfi_endproc\n"
+	"	.size	_ITM_beginTransaction, .-_ITM_beginTransaction\n"
+	"\n"
+	"	.globl	itm_longjmp\n"
+	"	.hidden	itm_longjmp\n"
+	"	.type	itm_longjmp, @function\n"
+	"itm_longjmp:\n"
+	"	movl	%esi, %eax\n"
+	"	movq	8(%rdi), %rbx\n"
+	"	movq	16(%rdi), %rbp\n"
+	"	movq	24(%rdi), %r12\n"
+	"	movq	32(%rdi), %r13\n"
+	"	movq	40(%rdi), %r14\n"
+	"	movq	48(%rdi), %r15\n"
+	"	movq	56(%rdi), %rdx\n"
+	"	movq	(%rdi), %rsp\n"
+	"	jmp	*%rdx\n"
+	"	.size	itm_longjmp, .-itm_longjmp\n"
+);
+
+extern "C" uint32_t _ITM_beginTransaction(uint32_t props, ...) __attribute__((returns_twice));
+
+__attribute__((constructor)) static void itm_init()
+{
+	const char *name = getenv("ITM_ENGINE");
+
+	if (name && !strcmp(name, "tl2"))
+		itm_eng = &itm_tl2_engine;
+	else if (name && strcmp(name, "ring"))
+		fprintf(stderr, "ITM_ENGINE=%s unknown, using ring\n", name);
+	itm_eng->sys_init();
+}
+
+static void itm_push(itm_vec *vec, void *p)
+{
+	if (vec->n == vec->cap) {
+		vec->cap = vec->cap ? vec->cap * 2 : 16;
+		vec->v = (void **)realloc(vec->v, vec->cap * sizeof(void *));
+	}
+	vec->v[vec->n++] = p;
+}
+
+static itm_thread *itm_self()
+{
+	itm_thread *t = itm_self_ptr;
+
+	if (__builtin_expect(t != NULL, true))
+		return t;
+
+	t = (itm_thread *)aligned_alloc(CACHELINE_BYTES, sizeof(itm_thread));
+	memset((void *)t, 0, sizeof(itm_thread));
+	t->id = itm_nthreads.fetch_add(1, std::memory_order_relaxed);
+	if (t->id >= ITM_MAX_THREADS) {
+		fprintf(stderr, "libitm_stm: more than %d threads\n", ITM_MAX_THREADS);
+		abort();
+	}
+	itm_threads[t->id] = t;
+	itm_eng->thread_init(t->id);
+	itm_self_ptr = t;
+	return t;
+}
+
+/* Revocable transactions run only while nobody holds the serial lock */
+static void itm_enter(itm_thread *t)
+{
+	for (;;) {
+		t->active.store(1, std::memory_order_seq_cst);
+		if (!itm_serial_owner.load(std::memory_order_seq_cst))
+			return;
+		t->active.store(0, std::memory_order_release);
+		while (itm_serial_owner.load(std::memory_order_acquire))
+			sched_yield();
+	}
+}
+
+static void itm_leave(itm_thread *t)
+{
+	t->active.store(0, std::memory_order_release);
+}
+
+/* t must not be active; returns once every other transaction is out */
+static void itm_serial_acquire(itm_thread *t)
+{
+	itm_thread *none = NULL;
+
+	while (!itm_serial_owner.compare_exchange_weak(none, t, std::memory_order_seq_cst)) {
+		none = NULL;
+		sched_yield();
+	}
+	int n = itm_nthreads.load(std::memory_order_acquire);
+	for (int i = 0; i < n && i < ITM_MAX_THREADS; i++) {
+		itm_thread *u = itm_threads[i];
+		while (u && u != t && u->active.load(std::memory_order_seq_cst))
+			sched_yield();
+	}
+	t->serial = true;
+}
+
+static void itm_serial_release(itm_thread *t)
+{
+	t->serial = false;
+	t->want_serial = false;
+	itm_serial_owner.store(NULL, std::memory_order_release);
+}
+
+/* Undo records are data, then a footer, so they can be walked backwards */
+static void itm_log(const void *addr, size_t len)
+{
+	itm_thread *t = itm_self();
+	size_t data = (len + 7) & ~(size_t)7;
+	size_t need = t->undo_len + data + sizeof(itm_undo_footer);
+
+	if (need > t->undo_cap) {
+		t->undo_cap = need * 2;
+		t->undo = (char *)realloc(t->undo, t->undo_cap);
+	}
+	memcpy(t->undo + t->undo_len, addr, len);
+	itm_undo_footer footer = { (void *)addr, len };
+	memcpy(t->undo + t->undo_len + data, &footer, sizeof(footer));
+	t->undo_len = need;
+}
+
+static void itm_rollback(itm_thread *t)
+{
+	while (t->undo_len) {
+		itm_undo_footer footer;
+		memcpy(&footer, t->undo + t->undo_len - sizeof(footer), sizeof(footer));
+		size_t start = t->undo_len - sizeof(footer) - ((footer.len + 7) & ~(size_t)7);
+		memcpy(footer.addr, t->undo + start, footer.len);
+		t->undo_len = start;
+	}
+	for (size_t i = t->undo_actions.n; i >= 2; i -= 2)
+		((_ITM_userUndoFunction)t->undo_actions.v[i - 2])(t->undo_actions.v[i - 1]);
+	for (size_t i = 0; i < t->allocs.n; i++)
+		free(t->allocs.v[i]);
+	t->undo_actions.n = 0;
+	t->commit_actions.n = 0;
+	t->allocs.n = 0;
+	t->frees.n = 0;
+}
+
+static void itm_finish(itm_thread *t)
+{
+	for (size_t i = 0; i < t->frees.n; i++)
+		free(t->frees.v[i]);
+	for (size_t i = 0; i < t->commit_actions.n; i += 2)
+		((_ITM_userCommitFunction)t->commit_actions.v[i])(t->commit_actions.v[i + 1]);
+	t->undo_len = 0;
+	t->undo_actions.n = 0;
+	t->commit_actions.n = 0;
+	t->allocs.n = 0;
+	t->frees.n = 0;
+}
+
+static uint32_t itm_serial_action(itm_thread *t)
+{
+	return (t->props & pr_uninstrumentedCode) ? a_runUninstrumentedCode : a_runInstrumentedCode;
+}
+
+extern "C" uint32_t itm_begin(uint32_t props, const itm_jmpbuf *jb)
+{
+	itm_thread *t = itm_self();
+
+	if (t->depth++ > 0)
+		return t->serial ? itm_serial_action(t) : a_runInstrumentedCode;
+
+	t->props = props;
+	t->checkpoint = *jb;
+	t->tid = itm_next_tid.fetch_add(1, std::memory_order_relaxed);
+	if (props & pr_doesGoIrrevocable) {
+		itm_serial_acquire(t);
+		return itm_serial_action(t);
+	}
+	itm_enter(t);
+	itm_eng->begin(true);
+	return a_runInstrumentedCode | a_saveLiveVariables;
+}
+
+void itm_restart()
+{
+	itm_thread *t = itm_self();
+
+	itm_rollback(t);
+	t->depth = 1;
+	if (t->want_serial && !t->serial) {
+		itm_leave(t);
+		itm_serial_acquire(t);
+	}
+	if (t->serial)
+		itm_longjmp(&t->checkpoint, itm_serial_action(t) | a_restoreLiveVariables);
+
+	itm_eng->begin(false);
+	itm_longjmp(&t->checkpoint, a_runInstrumentedCode | a_restoreLiveVariables);
+}
+
+extern "C" void _ITM_commitTransaction()
+{
+	itm_thread *t = itm_self();
+
+	if (--t->depth > 0)
+		return;
+	if (t->serial) {
+		itm_serial_release(t);
+	} else {
+		itm_eng->commit();
+		itm_leave(t);
+	}
+	itm_finish(t);
+}
+
+extern "C" void _ITM_commitTransactionEH(void *exc)
+{
+	_ITM_commitTransaction();
+}
+
+extern "C" void _ITM_abortTransaction(uint32_t reason)
+{
+	itm_thread *t = itm_self();
+
+	if (reason & userRetry)
+		itm_restart();
+	if (t->serial) {
+		fprintf(stderr, "libitm_stm: cannot cancel an irrevocable transaction\n");
+		abort();
+	}
+	if (t->depth > 1 && !(reason & outerAbort)) {
+		fprintf(stderr, "libitm_stm: nested transactions are flat, cannot cancel the inner one\n");
+		abort();
+	}
+	itm_rollback(t);
+	itm_leave(t);
+	t->depth = 0;
+	itm_longjmp(&t->checkpoint, a_abortTransaction | a_restoreLiveVariables);
+}
+
+extern "C" void _ITM_changeTransactionMode(uint32_t mode)
+{
+	itm_thread *t = itm_self();
+
+	if (t->serial)
+		return;
+	t->want_serial = true;
+	itm_restart();
+}
+
+extern "C" uint32_t _ITM_inTransaction()
+{
+	itm_thread *t = itm_self_ptr;
+
+	if (!t || !t->depth)
+		return outsideTransaction;
+	return t->serial ? inIrrevocableTransaction : inRetryableTransaction;
+}
+
+extern "C" _ITM_transactionId_t _ITM_getTransactionId()
+{
+	itm_thread *t = itm_self_ptr;
+
+	return t && t->depth ? t->tid : 0;
+}
+
+extern "C" int _ITM_versionCompatible(int version)
+{
+	return version == _ITM_VERSION_NO;
+}
+
+extern "C" const char *_ITM_libraryVersion()
+{
+	return "libitm_stm 1.0 (RingSTM/TL2)";
+}
+
+extern "C" void _ITM_error(const _ITM_srcLocation *loc, int errorCode)
+{
+	fprintf(stderr, "libitm_stm: error %d\n", errorCode);
+	abort();
+}
+
+extern "C" void _ITM_addUserCommitAction(_ITM_userCommitFunction fn, _ITM_transactionId_t tid, void *arg)
+{
+	itm_thread *t = itm_self();
+
+	itm_push(&t->commit_actions, (void *)fn);
+	itm_push(&t->commit_actions, arg);
+}
+
+extern "C" void _ITM_addUserUndoAction(_ITM_userUndoFunction fn, void *arg)
+{
+	itm_thread *t = itm_self();
+
+	itm_push(&t->undo_actions, (void *)fn);
+	itm_push(&t->undo_actions, arg);
+}
+
+extern "C" void _ITM_dropReferences(void *addr, size_t len)
+{
+}
+
+/* word access through the engine, or direct while serial */
+
+FORCE_INLINE uint64_t itm_read_word(itm_thread *t, uint64_t *w)
+{
+	return t->serial ? *w : itm_eng->read(w);
+}
+
+FORCE_INLINE void itm_write_word(itm_thread *t, uint64_t *w, uint64_t v)
+{
+	if (t->serial)
+		*w = v;
+	else
+		itm_eng->write(w, v);
+}
+
+static void itm_load(void *dst, const void *src, size_t n)
+{
+	itm_thread *t = itm_self();
+	uintptr_t a = (uintptr_t)src;
+	char *d = (char *)dst;
+
+	while (n) {
+		size_t off = a & 7, k = 8 - off < n ? 8 - off : n;
+		uint64_t v = itm_read_word(t, (uint64_t *)(a - off));
+		memcpy(d, (char *)&v + off, k);
+		a += k;
+		d += k;
+		n -= k;
+	}
+}
+
+static void itm_store(void *dst, const void *src, size_t n)
+{
+	itm_thread *t = itm_self();
+	uintptr_t a = (uintptr_t)dst;
+	const char *s = (const char *)src;
+
+	while (n) {
+		size_t off = a & 7, k = 8 - off < n ? 8 - off : n;
+		uint64_t *w = (uint64_t *)(a - off);
+		uint64_t v;
+		if (k == 8)
+			memcpy(&v, s, 8);
+		else {
+			v = itm_read_word(t, w);
+			memcpy((char *)&v + off, s, k);
+		}
+		itm_write_word(t, w, v);
+		a += k;
+		s += k;
+		n -= k;
+	}
+}
+
+template <typename T>
+FORCE_INLINE T itm_read(const T *p)
+{
+	T r;
+
+	if (sizeof(T) == 8 && !((uintptr_t)p & 7)) {
+		uint64_t v = itm_read_word(itm_self(), (uint64_t *)p);
+		memcpy(&r, &v, 8);
+	} else {
+		itm_load(&r, p, sizeof(T));
+	}
+	return r;
+}
+
+template <typename T>
+FORCE_INLINE void itm_write(T *p, T val)
+{
+	if (sizeof(T) == 8 && !((uintptr_t)p & 7)) {
+		uint64_t v;
+		memcpy(&v, &val, 8);
+		itm_write_word(itm_self(), (uint64_t *)p, v);
+	} else {
+		itm_store(p, &val, sizeof(T));
+	}
+}
+
+#define ITM_BARRIERS(T, N, ATTR)							\
+	extern "C" ATTR T _ITM_R##N(const T *p) { return itm_read(p); }		\
+	extern "C" ATTR T _ITM_RaR##N(const T *p) { return itm_read(p); }	\
+	extern "C" ATTR T _ITM_RaW##N(const T *p) { return itm_read(p); }	\
+	extern "C" ATTR T _ITM_RfW##N(const T *p) { return itm_read(p); }	\
+	extern "C" ATTR void _ITM_W##N(T *p, T v) { itm_write(p, v); }		\
+	extern "C" ATTR void _ITM_WaR##N(T *p, T v) { itm_write(p, v); }	\
+	extern "C" ATTR void _ITM_WaW##N(T *p, T v) { itm_write(p, v); }	\
+	extern "C" ATTR void _ITM_L##N(const T *p) { itm_log(p, sizeof(T)); }
+
+ITM_BARRIERS(uint8_t, U1, )
+ITM_BARRIERS(uint16_t, U2, )
+ITM_BARRIERS(uint32_t, U4, )
+ITM_BARRIERS(uint64_t, U8, )
+ITM_BARRIERS(float, F, )
+ITM_BARRIERS(double, D, )
+ITM_BARRIERS(long double, E, )
+ITM_BARRIERS(__complex__ float, CF, )
+ITM_BARRIERS(__complex__ double, CD, )
+ITM_BARRIERS(__complex__ long double, CE, )
+ITM_BARRIERS(__m64, M64, )
+ITM_BARRIERS(__m128, M128, )
+/* passed in ymm registers, as in gcc's libitm (hence -Wno-psabi) */
+ITM_BARRIERS(__m256, M256, __attribute__((target("avx"))))
+
+extern "C" void _ITM_LB(const void *p, size_t len)
+{
+	itm_log(p, len);
+}
+
+/* Rn/Wn are plain accesses, everything else goes through the engine */
+static void itm_copy(void *dst, const void *src, size_t n, bool rt, bool wt)
+{
+	char buf[ITM_CHUNK];
+	char *d = (char *)dst;
+	const char *s = (const char *)src;
+	/* like memmove: copy from the end when dst overlaps src from above */
+	bool back = d > s && d < s + n;
+
+	while (n) {
+		size_t k = n < ITM_CHUNK ? n : ITM_CHUNK;
+		const char *from = back ? s + n - k : s;
+		char *to = back ? d + n - k : d;
+
+		if (rt)
+			itm_load(buf, from, k);
+		else
+			memcpy(buf, from, k);
+		if (wt)
+			itm_store(to, buf, k);
+		else
+			memcpy(to, buf, k);
+		if (!back) {
+			s += k;
+			d += k;
+		}
+		n -= k;
+	}
+}
+
+#define ITM_COPY(R, W, RT, WT)								\
+	extern "C" void _ITM_memcpy##R##W(void *d, const void *s, size_t n)	\
+		{ itm_copy(d, s, n, RT, WT); }						\
+	extern "C" void _ITM_memmove##R##W(void *d, const void *s, size_t n)	\
+		{ itm_copy(d, s, n, RT, WT); }
+
+#define ITM_COPY_W(R, RT)			\
+	ITM_COPY(R, Wn, RT, false)		\
+	ITM_COPY(R, Wt, RT, true)		\
+	ITM_COPY(R, WtaR, RT, true)		\
+	ITM_COPY(R, WtaW, RT, true)
+
+ITM_COPY(Rn, Wt, false, true)
+ITM_COPY(Rn, WtaR, false, true)
+ITM_COPY(Rn, WtaW, false, true)
+ITM_COPY_W(Rt, true)
+ITM_COPY_W(RtaR, true)
+ITM_COPY_W(RtaW, true)
+
+static void itm_set(void *dst, int c, size_t n)
+{
+	char buf[ITM_CHUNK];
+	char *d = (char *)dst;
+
+	memset(buf, c, n < ITM_CHUNK ? n : ITM_CHUNK);
+	while (n) {
+		size_t k = n < ITM_CHUNK ? n : ITM_CHUNK;
+		itm_store(d, buf, k);
+		d += k;
+		n -= k;
+	}
+}
+
+extern "C" void _ITM_memsetW(void *d, int c, size_t n) { itm_set(d, c, n); }
+extern "C" void _ITM_memsetWaR(void *d, int c, size_t n) { itm_set(d, c, n); }
+extern "C" void _ITM_memsetWaW(void *d, int c, size_t n) { itm_set(d, c, n); }
+
+/* allocation: undone on abort, frees deferred to commit */
+
+extern "C" void *_ITM_malloc(size_t size)
+{
+	itm_thread *t = itm_self();
+	void *p = malloc(size);
+
+	if (p && t->depth && !t->serial)
+		itm_push(&t->allocs, p);
+	return p;
+}
+
+extern "C" void *_ITM_calloc(size_t n, size_t size)
+{
+	itm_thread *t = itm_self();
+	void *p = calloc(n, size);
+
+	if (p && t->depth && !t->serial)
+		itm_push(&t->allocs, p);
+	return p;
+}
+
+extern "C" void _ITM_free(void *p)
+{
+	itm_thread *t = itm_self();
+
+	if (p && t->depth && !t->serial)
+		itm_push(&t->frees, p);
+	else
+		free(p);
+}
+
+/* transactional clones of operator new and delete */
+static void *itm_new(size_t size)
+{
+	void *p = _ITM_malloc(size ? size : 1);
+
+	if (!p) {
+		fprintf(stderr, "libitm_stm: out of memory in a transaction\n");
+		abort();
+	}
+	return p;
+}
+
+extern "C" void *_ZGTtnwm(size_t size) { return itm_new(size); }
+extern "C" void *_ZGTtnam(size_t size) { return itm_new(size); }
+extern "C" void *_ZGTtnwmRKSt9nothrow_t(size_t size, const void *) { return _ITM_malloc(size ? size : 1); }
+extern "C" void *_ZGTtnamRKSt9nothrow_t(size_t size, const void *) { return _ITM_malloc(size ? size : 1); }
+extern "C" void _ZGTtdlPv(void *p) { _ITM_free(p); }
+extern "C" void _ZGTtdaPv(void *p) { _ITM_free(p); }
+extern "C" void _ZGTtdlPvm(void *p, size_t) { _ITM_free(p); }
+extern "C" void _ZGTtdaPvm(void *p, size_t) { _ITM_free(p); }
+extern "C" void _ZGTtdlPvRKSt9nothrow_t(void *p, const void *) { _ITM_free(p); }
+extern "C" void _ZGTtdaPvRKSt9nothrow_t(void *p, const void *) { _ITM_free(p); }
+
+/* clone tables for indirect calls, registered by crtbegin */
+
+extern "C" void _ITM_registerTMCloneTable(void *table, size_t n)
+{
+	itm_clone_table *c = (itm_clone_table *)malloc(sizeof(itm_clone_table));
+
+	c->pairs = (void **)table;
+	c->n = n;
+	pthread_mutex_lock(&itm_clones_lock);
+	c->next = itm_clones;
+	itm_clones = c;
+	pthread_mutex_unlock(&itm_clones_lock);
+}
+
+extern "C" void _ITM_deregisterTMCloneTable(void *table)
+{
+	pthread_mutex_lock(&itm_clones_lock);
+	for (itm_clone_table **c = &itm_clones; *c; c = &(*c)->next) {
+		if ((*c)->pairs == table) {
+			itm_clone_table *dead = *c;
+			*c = dead->next;
+			free(dead);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&itm_clones_lock);
+}
+
+static void *itm_find_clone(void *fn)
+{
+	void *clone = NULL;
+
+	pthread_mutex_lock(&itm_clones_lock);
+	for (itm_clone_table *c = itm_clones; c && !clone; c = c->next)
+		for (size_t i = 0; i < c->n; i++)
+			if (c->pairs[2 * i] == fn) {
+				clone = c->pairs[2 * i + 1];
+				break;
+			}
+	pthread_mutex_unlock(&itm_clones_lock);
+	return clone;
+}
+
+extern "C" void *_ITM_getTMCloneSafe(void *fn)
+{
+	void *clone = itm_find_clone(fn);
+
+	if (!clone) {
+		fprintf(stderr, "libitm_stm: no transactional clone for %p\n", fn);
+		abort();
+	}
+	return clone;
+}
+
+extern "C" void *_ITM_getTMCloneOrIrrevocable(void *fn)
+{
+	void *clone = itm_find_clone(fn);
+
+	if (clone)
+		return clone;
+	_ITM_changeTransactionMode(modeSerialIrrevocable);
+	return fn;
+}
@@ -0,0 +1,41 @@
+#ifndef TM_ITM_HPP
+#define TM_ITM_HPP 1
+
+#include <stdint.h>
+
+/**
+ *  The word-level engines as seen by the libitm ABI layer (itm.c).
+ *
+ *  Each engine is compiled in its own translation unit (itm_ring.c,
+ *  itm_tl2.c), with its header wrapped in a namespace. Both headers
+ *  define a Tx_Context, Self and thread_init(), and the namespaces keep
+ *  them from colliding in one library. Those units only export the
+ *  function table below. itm.c picks a table at start-up from
+ *  $ITM_ENGINE ("ring", the default, or "tl2").
+ *
+ *  The engines abort through TM_RESTART(). Here it calls itm_restart(),
+ *  which rolls the ABI-level logs back and resumes at the checkpoint
+ *  taken by _ITM_beginTransaction.
+ */
+
+struct itm_engine
+{
+	const char *name;
+	void (*sys_init)();
+	void (*thread_init)(int id);
+	void (*begin)(bool first);		/* first: not a retry */
+	uint64_t (*read)(uint64_t *addr);
+	void (*write)(uint64_t *addr, uint64_t val);
+	void (*commit)();
+	void (*counts)(long *commits, long *aborts);
+};
+
+extern const itm_engine itm_ring_engine;
+extern const itm_engine itm_tl2_engine;
+
+/* Never returns: resumes the current transaction from its checkpoint */
+void itm_restart() __attribute__((noreturn));
+
+#define TM_RESTART(tx)	itm_restart()
+
+#endif //TM_ITM_HPP
@@ -0,0 +1,70 @@
+/* RingSTM behind the libitm layer; see itm.hpp */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <atomic>
+#include "rand_r_32.h"
+#include "WriteSet.hpp"
+#include "BitFilter.h"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "itm.hpp"
+
+namespace itm_ring
+{
+#include "ring_stm.hpp"
+#include "ring_stm.c"
+
+static void begin(bool first)
+{
+	TM_TX_VAR
+	if (first) {
+		TM_STATS_BEGIN(tx)
+	}
+	ring_tm_begin(tx);
+}
+
+static uint64_t read(uint64_t *addr)
+{
+	return ring_tm_read(addr, Self);
+}
+
+static void write(uint64_t *addr, uint64_t val)
+{
+	ring_tm_write(addr, val, Self);
+}
+
+static void commit()
+{
+	TM_TX_VAR
+	ring_tm_commit(tx);
+	TM_STATS_END(tx)
+}
+
+static void counts(long *commits, long *aborts)
+{
+	*commits = Self ? Self->commits : 0;
+	*aborts = Self ? Self->aborts : 0;
+}
+}
+
+const itm_engine itm_ring_engine = {
+	"ring", itm_ring::tm_sys_init, itm_ring::thread_init, itm_ring::begin,
+	itm_ring::read, itm_ring::write, itm_ring::commit, itm_ring::counts
+};
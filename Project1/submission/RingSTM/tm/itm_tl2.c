@@ -0,0 +1,70 @@
+/* TL2 behind the libitm layer; see itm.hpp */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <algorithm>
+#include <atomic>
+#include "rand_r_32.h"
+#include "WriteSet.hpp"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+#include "itm.hpp"
+
+namespace itm_tl2
+{
+#include "tm_thread.hpp"
+#include "tm_thread.c"
+
+static void begin(bool first)
+{
+	TM_TX_VAR
+	if (first) {
+		TM_STATS_BEGIN(tx)
+	}
+	tm_begin(tx);
+}
+
+static uint64_t read(uint64_t *addr)
+{
+	return tm_read(addr, Self);
+}
+
+static void write(uint64_t *addr, uint64_t val)
+{
+	tm_write(addr, val, Self);
+}
+
+static void commit()
+{
+	TM_TX_VAR
+	tm_commit(tx);
+	TM_STATS_END(tx)
+}
+
+static void counts(long *commits, long *aborts)
+{
+	*commits = Self ? Self->commits : 0;
+	*aborts = Self ? Self->aborts : 0;
+}
+}
+
+const itm_engine itm_tl2_engine = {
+	"tl2", itm_tl2::tm_sys_init, itm_tl2::thread_init, itm_tl2::begin,
+	itm_tl2::read, itm_tl2::write, itm_tl2::commit, itm_tl2::counts
+};
@@ -0,0 +1,343 @@
+#ifndef TM_KCAS_HPP
+#define TM_KCAS_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include "wait.hpp"
+#include "ebr.hpp"
+
+/**
+ *  Lock-free multi-word compare-and-swap (Harris, Fraser and Pratt).
+ *
+ *  A k-CAS fills a kcas_desc with (address, expected, new) triples and
+ *  calls kcas_commit(). The entries are sorted by address. The descriptor
+ *  is then installed in each word in turn with RDCSS, a double-compare
+ *  single-swap that only installs while the descriptor is still
+ *  UNDECIDED. Once every word is claimed, or one of them is found
+ *  holding another value, the status is decided with a single CAS. The
+ *  descriptor is then swapped out for the new values, or for the old
+ *  ones if the k-CAS failed.
+ *
+ *  A thread that meets a descriptor while reading or installing runs it to
+ *  completion itself, so a stalled thread never blocks the others.
+ *  Descriptors are recycled through epoch-based reclamation (tm/ebr.hpp).
+ *  Every operation runs inside an epoch, and a descriptor retired while
+ *  the global epoch is e is only reused once it has reached e + 2.
+ *
+ *  The two low bits of a word tag descriptors, so words hold values
+ *  shifted left by two. Use kcas_init()/kcas_read() rather than touching
+ *  the words directly.
+ */
+
+#define KCAS_MAX_ENTRIES	8		/* words per k-CAS */
+#define KCAS_MAX_THREADS	EBR_MAX_THREADS
+#define KCAS_RETIRE_BATCH	64		/* retires between epoch attempts */
+
+#define KCAS_RDCSS_BIT		1
+#define KCAS_DESC_BIT		2
+#define KCAS_TAGS		3
+
+#define KCAS_UNDECIDED		0
+#define KCAS_SUCCEEDED		1
+#define KCAS_FAILED		2
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES 64
+#endif
+
+typedef std::atomic<uintptr_t> kcas_word;
+
+struct kcas_entry
+{
+	kcas_word *addr;
+	uintptr_t old_val;			/* encoded */
+	uintptr_t new_val;			/* encoded */
+};
+
+struct kcas_desc
+{
+	std::atomic<int> status;
+	int n;
+	kcas_entry entries[KCAS_MAX_ENTRIES];
+	kcas_desc *next;			/* free and limbo lists */
+};
+
+struct rdcss_desc
+{
+	std::atomic<int> *status;		/* installs only while UNDECIDED */
+	kcas_word *addr;
+	uintptr_t old_val;
+	uintptr_t new_val;			/* the tagged kcas_desc */
+	rdcss_desc *next;
+};
+
+struct kcas_thread
+{
+	ebr_slot *slot;
+	uint64_t epoch;				/* global epoch at our last reclaim */
+	unsigned int retired;
+	kcas_desc *desc_free;
+	rdcss_desc *rdcss_free;
+	ebr_limbo<kcas_desc> desc_limbo;
+	ebr_limbo<rdcss_desc> rdcss_limbo;
+	char pad[CACHELINE_BYTES];
+};
+
+struct kcas_global
+{
+	ebr_domain ebr;
+	kcas_thread threads[KCAS_MAX_THREADS];
+};
+
+inline kcas_global& kcas_state()
+{
+	static kcas_global state;
+	return state;
+}
+
+inline kcas_thread*& kcas_self()
+{
+	static __thread kcas_thread *self;
+	return self;
+}
+
+FORCE_INLINE uintptr_t kcas_encode(uintptr_t val)
+{
+	return val << 2;
+}
+
+FORCE_INLINE uintptr_t kcas_decode(uintptr_t word)
+{
+	return word >> 2;
+}
+
+/* Call once per thread before its first k-CAS; ids must be unique and
+ * below KCAS_MAX_THREADS */
+inline void kcas_thread_init(int id)
+{
+	kcas_global& g = kcas_state();
+	ebr_slot *slot = ebr_register(&g.ebr, id);
+	kcas_thread *t = &g.threads[id];
+
+	t->slot = slot;
+	t->epoch = g.ebr.epoch.load(std::memory_order_relaxed);
+	kcas_self() = t;
+}
+
+/* Only before other threads can see the word */
+FORCE_INLINE void kcas_init(kcas_word *addr, uintptr_t val)
+{
+	addr->store(kcas_encode(val), std::memory_order_relaxed);
+}
+
+/* Back onto the free lists */
+FORCE_INLINE void kcas_free_desc(kcas_thread *t, kcas_desc *d)
+{
+	d->next = t->desc_free;
+	t->desc_free = d;
+}
+
+FORCE_INLINE void kcas_free_rdcss(kcas_thread *t, rdcss_desc *r)
+{
+	r->next = t->rdcss_free;
+	t->rdcss_free = r;
+}
+
+/* Move everything retired at least two epochs ago onto the free lists */
+inline void kcas_reclaim(kcas_thread *t, uint64_t now)
+{
+	ebr_reclaim(&t->desc_limbo, now, [t](kcas_desc *d) { kcas_free_desc(t, d); });
+	ebr_reclaim(&t->rdcss_limbo, now, [t](rdcss_desc *r) { kcas_free_rdcss(t, r); });
+	t->epoch = now;
+}
+
+FORCE_INLINE void kcas_enter()
+{
+	kcas_thread *t = kcas_self();
+	uint64_t now = ebr_enter(&kcas_state().ebr, t->slot);
+
+	if (__builtin_expect(now != t->epoch, false))
+		kcas_reclaim(t, now);
+}
+
+FORCE_INLINE void kcas_exit()
+{
+	ebr_exit(kcas_self()->slot);
+}
+
+FORCE_INLINE void kcas_retired(kcas_thread *t)
+{
+	if (++t->retired >= KCAS_RETIRE_BATCH) {
+		t->retired = 0;
+		ebr_try_advance(&kcas_state().ebr);
+	}
+}
+
+FORCE_INLINE void kcas_retire_desc(kcas_desc *d)
+{
+	kcas_thread *t = kcas_self();
+
+	ebr_retire(&kcas_state().ebr, &t->desc_limbo, d, [t](kcas_desc *p) { kcas_free_desc(t, p); });
+	kcas_retired(t);
+}
+
+FORCE_INLINE void kcas_retire_rdcss(rdcss_desc *r)
+{
+	kcas_thread *t = kcas_self();
+
+	ebr_retire(&kcas_state().ebr, &t->rdcss_limbo, r, [t](rdcss_desc *p) { kcas_free_rdcss(t, p); });
+	kcas_retired(t);
+}
+
+FORCE_INLINE rdcss_desc *kcas_alloc_rdcss()
+{
+	kcas_thread *t = kcas_self();
+	rdcss_desc *r = t->rdcss_free;
+
+	if (r)
+		t->rdcss_free = r->next;
+	else
+		r = (rdcss_desc *)malloc(sizeof(rdcss_desc));
+	return r;
+}
+
+/* Swaps an installed RDCSS descriptor for its outcome */
+FORCE_INLINE void rdcss_complete(rdcss_desc *r)
+{
+	uintptr_t expected = (uintptr_t)r | KCAS_RDCSS_BIT;
+	uintptr_t val = r->status->load(std::memory_order_acquire) == KCAS_UNDECIDED ?
+			r->new_val : r->old_val;
+
+	r->addr->compare_exchange_strong(expected, val, std::memory_order_acq_rel);
+}
+
+/* Returns what was in the word; the swap happened iff that is old_val */
+inline uintptr_t rdcss(rdcss_desc *r)
+{
+	uintptr_t seen;
+
+	for (;;) {
+		seen = r->old_val;
+		if (r->addr->compare_exchange_strong(seen, (uintptr_t)r | KCAS_RDCSS_BIT,
+				std::memory_order_acq_rel, std::memory_order_acquire)) {
+			rdcss_complete(r);
+			return seen;
+		}
+		if (!(seen & KCAS_RDCSS_BIT))
+			return seen;
+		rdcss_complete((rdcss_desc *)(seen & ~(uintptr_t)KCAS_TAGS));
+	}
+}
+
+FORCE_INLINE uintptr_t rdcss_read(kcas_word *addr)
+{
+	uintptr_t seen;
+
+	while ((seen = addr->load(std::memory_order_acquire)) & KCAS_RDCSS_BIT)
+		rdcss_complete((rdcss_desc *)(seen & ~(uintptr_t)KCAS_TAGS));
+	return seen;
+}
+
+/* Runs d to completion; called by the owner and by anyone it is in the way of */
+inline bool kcas_help(kcas_desc *d)
+{
+	uintptr_t tagged = (uintptr_t)d | KCAS_DESC_BIT;
+
+	if (d->status.load(std::memory_order_acquire) == KCAS_UNDECIDED) {
+		int outcome = KCAS_SUCCEEDED;
+
+		for (int i = 0; i < d->n && outcome == KCAS_SUCCEEDED; i++) {
+			/* one RDCSS descriptor per word: a late helper may still
+			   complete it after we have moved on */
+			rdcss_desc *r = kcas_alloc_rdcss();
+
+			r->status = &d->status;
+			r->addr = d->entries[i].addr;
+			r->old_val = d->entries[i].old_val;
+			r->new_val = tagged;
+			for (;;) {
+				uintptr_t seen = rdcss(r);
+				if (seen == tagged || seen == r->old_val)
+					break;
+				if (seen & KCAS_DESC_BIT) {
+					kcas_help((kcas_desc *)(seen & ~(uintptr_t)KCAS_TAGS));
+					continue;
+				}
+				outcome = KCAS_FAILED;
+				break;
+			}
+			kcas_retire_rdcss(r);
+		}
+
+		int undecided = KCAS_UNDECIDED;
+		d->status.compare_exchange_strong(undecided, outcome, std::memory_order_acq_rel);
+	}
+
+	bool succeeded = d->status.load(std::memory_order_acquire) == KCAS_SUCCEEDED;
+	for (int i = 0; i < d->n; i++) {
+		uintptr_t expected = tagged;
+		d->entries[i].addr->compare_exchange_strong(expected,
+				succeeded ? d->entries[i].new_val : d->entries[i].old_val,
+				std::memory_order_acq_rel);
+	}
+	return succeeded;
+}
+
+/* Current value of the word, finishing any k-CAS that is in its way */
+inline uintptr_t kcas_read(kcas_word *addr)
+{
+	uintptr_t seen;
+
+	kcas_enter();
+	while ((seen = rdcss_read(addr)) & KCAS_DESC_BIT)
+		kcas_help((kcas_desc *)(seen & ~(uintptr_t)KCAS_TAGS));
+	kcas_exit();
+
+	return kcas_decode(seen);
+}
+
+FORCE_INLINE kcas_desc *kcas_begin()
+{
+	kcas_thread *t = kcas_self();
+	kcas_desc *d = t->desc_free;
+
+	if (d)
+		t->desc_free = d->next;
+	else
+		d = (kcas_desc *)malloc(sizeof(kcas_desc));
+	d->status.store(KCAS_UNDECIDED, std::memory_order_relaxed);
+	d->n = 0;
+	return d;
+}
+
+FORCE_INLINE void kcas_add(kcas_desc *d, kcas_word *addr, uintptr_t old_val, uintptr_t new_val)
+{
+	kcas_entry *e = &d->entries[d->n++];
+
+	e->addr = addr;
+	e->old_val = kcas_encode(old_val);
+	e->new_val = kcas_encode(new_val);
+}
+
+/* Atomically applies every entry of d if all words still hold their
+   expected values. d is recycled and must not be used afterwards. */
+inline bool kcas_commit(kcas_desc *d)
+{
+	/* a global order keeps helpers from chasing each other in circles */
+	for (int i = 1; i < d->n; i++)
+		for (int j = i; j > 0 && d->entries[j].addr < d->entries[j - 1].addr; j--) {
+			kcas_entry e = d->entries[j];
+			d->entries[j] = d->entries[j - 1];
+			d->entries[j - 1] = e;
+		}
+
+	kcas_enter();
+	bool succeeded = kcas_help(d);
+	kcas_retire_desc(d);
+	kcas_exit();
+
+	return succeeded;
+}
+
+#endif //TM_KCAS_HPP
@@ -0,0 +1,73 @@
+#ifndef TM_LATENCY_HPP
+#define TM_LATENCY_HPP 1
+
+#include <stdint.h>
+#include <string.h>
+
+/**
+ *  Per-thread latency histograms for the drivers (-l).
+ *
+ *  Buckets are log-linear: LAT_SUB buckets per power of two, so every
+ *  bucket is within 1/LAT_SUB of its value and a histogram stays a few
+ *  KB. A thread records into its own histogram. The driver merges them
+ *  once the run is over and reads percentiles off the result.
+ */
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+#define LAT_SUB_BITS	3
+#define LAT_SUB		(1 << LAT_SUB_BITS)	/* buckets per power of two */
+#define LAT_BUCKETS	(64 * LAT_SUB)
+
+struct lat_hist
+{
+	uint64_t count[LAT_BUCKETS];
+	uint64_t total;
+};
+
+FORCE_INLINE int lat_bucket(uint64_t ns)
+{
+	if (ns < LAT_SUB)
+		return (int)ns;
+	int log = 63 - __builtin_clzll(ns);
+	return (log - LAT_SUB_BITS + 1) * LAT_SUB + (int)((ns >> (log - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* The smallest value that lands in bucket b */
+inline uint64_t lat_value(int b)
+{
+	if (b < LAT_SUB)
+		return b;
+	int log = b / LAT_SUB + LAT_SUB_BITS - 1;
+	return (1ULL << log) | ((uint64_t)(b % LAT_SUB) << (log - LAT_SUB_BITS));
+}
+
+FORCE_INLINE void lat_record(lat_hist *h, uint64_t ns)
+{
+	h->count[lat_bucket(ns)]++;
+	h->total++;
+}
+
+inline void lat_merge(lat_hist *into, const lat_hist *from)
+{
+	for (int b = 0; b < LAT_BUCKETS; b++)
+		into->count[b] += from->count[b];
+	into->total += from->total;
+}
+
+/* Lower bound of the bucket holding the pct-th percentile */
+inline uint64_t lat_percentile(const lat_hist *h, double pct)
+{
+	uint64_t rank = (uint64_t)(h->total * pct / 100.0), seen = 0;
+
+	for (int b = 0; b < LAT_BUCKETS; b++) {
+		seen += h->count[b];
+		if (seen > rank)
+			return lat_value(b);
+	}
+	return h->total ? lat_value(LAT_BUCKETS - 1) : 0;
+}
+
+#endif //TM_LATENCY_HPP
@@ -0,0 +1,324 @@
+#ifndef TM_OBJECT_HPP
+#define TM_OBJECT_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <atomic>
+#include "wait.hpp"
+#include "BitFilter.h"
+#include "ebr.hpp"
+
+/**
+ *  Object-based STM: whole structs instead of words, in the style of
+ *  DSTM and versioned boxes.
+ *
+ *  A tm_obj<T> is a header holding a versioned lock and a pointer to the
+ *  current version of the T. obj_read() returns the current version as
+ *  is, after the usual TL2 check: the lock was free and not newer than
+ *  the snapshot. obj_write() copies the current version into a private
+ *  clone, which the transaction then changes with plain stores. A record
+ *  update thus costs one open instead of a read and a write per field.
+ *
+ *  Commit tries the locks of the written objects without waiting. It
+ *  takes a timestamp, validates the reads when anything committed since
+ *  the start, and points every header at its clone. The replaced
+ *  versions are freed through epoch-based reclamation (tm/ebr.hpp),
+ *  because concurrent readers may still be looking at them.
+ */
+
+#define OBJ_ACCESS_SIZE		4096		/* objects per transaction */
+#define OBJ_MAX_THREADS		EBR_MAX_THREADS
+#define OBJ_RETIRE_BATCH	64		/* retires between epoch attempts */
+
+#ifndef CACHELINE_BYTES
+#define CACHELINE_BYTES 64
+#endif
+
+/* A version of some object; the T follows in obj_box<T> */
+struct obj_version
+{
+	obj_version *next;				/* limbo lists */
+	obj_version *(*clone)(const obj_version *v);
+	void (*destroy)(obj_version *v);
+};
+
+template <typename T>
+struct obj_box : obj_version
+{
+	T data;
+
+	static obj_version *clone_box(const obj_version *v)
+	{
+		return new obj_box<T>(*static_cast<const obj_box<T> *>(v));
+	}
+
+	static void destroy_box(obj_version *v)
+	{
+		delete static_cast<obj_box<T> *>(v);
+	}
+
+	explicit obj_box(const T& init) : data(init)
+	{
+		next = NULL;
+		clone = clone_box;
+		destroy = destroy_box;
+	}
+};
+
+struct obj_header
+{
+	std::atomic<uint64_t> lock;			/* timestamp << 1 | locked */
+	std::atomic<obj_version *> current;
+};
+
+template <typename T>
+struct tm_obj : obj_header
+{
+	explicit tm_obj(const T& init)
+	{
+		lock.store(0, std::memory_order_relaxed);
+		current.store(new obj_box<T>(init), std::memory_order_release);
+	}
+};
+
+struct obj_read_entry
+{
+	obj_header *obj;
+	uint64_t seen;					/* lock word when opened */
+};
+
+struct obj_write_entry
+{
+	obj_header *obj;
+	uint64_t seen;
+	obj_version *clone;
+};
+
+struct obj_tx
+{
+	int id;
+	jmp_buf scope;
+	uint64_t start;					/* snapshot timestamp */
+	int reads_pos;
+	obj_read_entry reads[OBJ_ACCESS_SIZE];
+	int writes_pos;
+	obj_write_entry writes[OBJ_ACCESS_SIZE];
+	BitFilter<1024> write_filter;			/* objects we may have cloned */
+
+	/* reclamation, see ebr.hpp */
+	ebr_slot *slot;
+	uint64_t epoch;					/* global epoch at our last reclaim */
+	unsigned int retired;
+	ebr_limbo<obj_version> limbo;
+
+	long commits, aborts;
+	char pad[CACHELINE_BYTES];
+};
+
+struct obj_global
+{
+	std::atomic<uint64_t> clock;
+	char pad[CACHELINE_BYTES - sizeof(uint64_t)];
+	ebr_domain ebr;
+	obj_tx threads[OBJ_MAX_THREADS];
+};
+
+inline obj_global& obj_state()
+{
+	static obj_global state;
+	return state;
+}
+
+inline obj_tx*& obj_self()
+{
+	static __thread obj_tx *self;
+	return self;
+}
+
+/* Call once per thread before its first transaction; ids must be unique
+ * and below OBJ_MAX_THREADS */
+inline void obj_thread_init(int id)
+{
+	obj_global& g = obj_state();
+	ebr_slot *slot = ebr_register(&g.ebr, id);
+	obj_tx *tx = &g.threads[id];
+
+	tx->id = id;
+	tx->slot = slot;
+	tx->epoch = g.ebr.epoch.load(std::memory_order_relaxed);
+	tx->commits = tx->aborts = 0;
+	obj_self() = tx;
+}
+
+FORCE_INLINE void obj_destroy(obj_version *v)
+{
+	v->destroy(v);
+}
+
+FORCE_INLINE void obj_retire(obj_tx *tx, obj_version *v)
+{
+	obj_global& g = obj_state();
+
+	ebr_retire(&g.ebr, &tx->limbo, v, obj_destroy);
+	if (++tx->retired >= OBJ_RETIRE_BATCH) {
+		tx->retired = 0;
+		ebr_try_advance(&g.ebr);
+	}
+}
+
+FORCE_INLINE void obj_begin(obj_tx *tx)
+{
+	obj_global& g = obj_state();
+	uint64_t now = ebr_enter(&g.ebr, tx->slot);
+
+	if (__builtin_expect(now != tx->epoch, false)) {
+		ebr_reclaim(&tx->limbo, now, obj_destroy);
+		tx->epoch = now;
+	}
+
+	tx->reads_pos = 0;
+	tx->writes_pos = 0;
+	tx->write_filter.clear();
+	tx->start = g.clock.load(std::memory_order_acquire);
+}
+
+inline void obj_abort(obj_tx *tx)
+{
+	for (int i = 0; i < tx->writes_pos; i++)
+		tx->writes[i].clone->destroy(tx->writes[i].clone);
+	ebr_exit(tx->slot);
+	tx->aborts++;
+	longjmp(tx->scope, 1);
+}
+
+/* Our clone of obj, or NULL */
+FORCE_INLINE obj_write_entry *obj_find_write(obj_tx *tx, obj_header *obj)
+{
+	if (!tx->write_filter.lookup(obj))
+		return NULL;
+	for (int i = 0; i < tx->writes_pos; i++)
+		if (tx->writes[i].obj == obj)
+			return &tx->writes[i];
+	return NULL;
+}
+
+/* The current version, consistent with the snapshot */
+inline obj_version *obj_open(obj_tx *tx, obj_header *obj, uint64_t *seen)
+{
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	for (;;) {
+		uint64_t l1 = obj->lock.load(std::memory_order_acquire);
+		if (l1 & 1) {			/* a commit is swapping it */
+			tm_poll(&p);
+			continue;
+		}
+		obj_version *v = obj->current.load(std::memory_order_acquire);
+		if (obj->lock.load(std::memory_order_acquire) != l1)
+			continue;
+		if ((l1 >> 1) > tx->start)
+			obj_abort(tx);
+		*seen = l1;
+		return v;
+	}
+}
+
+template <typename T>
+FORCE_INLINE const T *obj_read(obj_tx *tx, tm_obj<T> *obj)
+{
+	obj_write_entry *w = obj_find_write(tx, obj);
+	if (w)
+		return &static_cast<obj_box<T> *>(w->clone)->data;
+
+	obj_read_entry *r = &tx->reads[tx->reads_pos++];
+	r->obj = obj;
+	return &static_cast<obj_box<T> *>(obj_open(tx, obj, &r->seen))->data;
+}
+
+template <typename T>
+FORCE_INLINE T *obj_write(obj_tx *tx, tm_obj<T> *obj)
+{
+	obj_write_entry *w = obj_find_write(tx, obj);
+	if (!w) {
+		w = &tx->writes[tx->writes_pos];
+		w->obj = obj;
+		obj_version *v = obj_open(tx, obj, &w->seen);
+		w->clone = v->clone(v);
+		tx->writes_pos++;
+		tx->write_filter.add(obj);
+	}
+	return &static_cast<obj_box<T> *>(w->clone)->data;
+}
+
+/* Every read object still carries the lock word we saw, or is ours */
+inline bool obj_validate(obj_tx *tx)
+{
+	for (int i = 0; i < tx->reads_pos; i++) {
+		obj_read_entry *r = &tx->reads[i];
+		uint64_t lock = r->obj->lock.load(std::memory_order_acquire);
+		if (lock == r->seen)
+			continue;
+		if (lock != (r->seen | 1) || !obj_find_write(tx, r->obj))
+			return false;
+	}
+	return true;
+}
+
+inline void obj_commit(obj_tx *tx)
+{
+	obj_global& g = obj_state();
+
+	if (tx->writes_pos == 0) {		/* read-only: valid at start */
+		ebr_exit(tx->slot);
+		tx->commits++;
+		return;
+	}
+
+	for (int i = 0; i < tx->writes_pos; i++) {
+		obj_write_entry *w = &tx->writes[i];
+		uint64_t seen = w->seen;
+		if (!w->obj->lock.compare_exchange_strong(seen, w->seen | 1,
+				std::memory_order_acquire, std::memory_order_relaxed)) {
+			for (int j = 0; j < i; j++)
+				tx->writes[j].obj->lock.store(tx->writes[j].seen, std::memory_order_release);
+			obj_abort(tx);
+		}
+	}
+
+	uint64_t ts = g.clock.fetch_add(1, std::memory_order_acq_rel) + 1;
+	if (ts != tx->start + 1 && !obj_validate(tx)) {
+		for (int i = 0; i < tx->writes_pos; i++)
+			tx->writes[i].obj->lock.store(tx->writes[i].seen, std::memory_order_release);
+		obj_abort(tx);
+	}
+
+	for (int i = 0; i < tx->writes_pos; i++) {
+		obj_write_entry *w = &tx->writes[i];
+		obj_version *old = w->obj->current.load(std::memory_order_relaxed);
+		w->obj->current.store(w->clone, std::memory_order_release);
+		w->obj->lock.store(ts << 1, std::memory_order_release);
+		obj_retire(tx, old);
+	}
+	ebr_exit(tx->slot);
+	tx->commits++;
+}
+
+#define OBJ_BEGIN						\
+	{							\
+		obj_tx *otx = obj_self();			\
+		_setjmp(otx->scope);				\
+		{						\
+			obj_begin(otx);
+
+#define OBJ_END							\
+			obj_commit(otx);			\
+		}						\
+	}
+
+#define OBJ_READ(obj)	obj_read(otx, (obj))
+#define OBJ_WRITE(obj)	obj_write(otx, (obj))
+
+#endif //TM_OBJECT_HPP
@@ -0,0 +1,182 @@
+#ifndef TM_ORDERED_HPP
+#define TM_ORDERED_HPP 1
+
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include "tm.hpp"
+
+/**
+ *  Ordered transactions on the global RingSTM, and a speculative
+ *  parallel loop built on them.
+ *
+ *  An ordered transaction carries a sequence number and ends with
+ *  TM_END_ORDERED(turn, order). It waits until *turn reaches its order,
+ *  validates against everything committed since it started, commits and
+ *  passes the turn on. Commits are serialized in the ring, so everything
+ *  that committed after the transaction started has a lower order.
+ *  Overlapping with any of them aborts it and the transaction reruns. The
+ *  result is the same as running the transactions one by one in order.
+ *
+ *  parallel_for_speculative() runs fn(i) for i in [lo, hi) that way on
+ *  a pool of workers. Iterations are handed out in order from a shared
+ *  counter, so the one a waiting transaction depends on is always
+ *  running somewhere and the loop cannot deadlock.
+ *
+ *  The turn is polled and then yielded (tm_poll()). tm_wait()'s long backoff would
+ *  keep a worker off the cpu the predecessor needs, as in delegate.hpp.
+ *  Admission control could hold a token while the predecessor waits for
+ *  one, so the two are not combined.
+ */
+
+#if !defined(RING_TM_HPP)
+#error "ordered transactions need the global RingSTM"
+#endif
+#if defined(TM_ADMISSION)
+#error "ordered transactions cannot wait for their turn under admission control"
+#endif
+
+#define ORDER_SPINS		256		/* polls of the turn before yielding */
+#define POOL_MAX_WORKERS	256
+
+FORCE_INLINE void tm_order_wait(std::atomic<uint64_t> *turn, uint64_t order)
+{
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	while (turn->load(std::memory_order_acquire) != order)
+		tm_poll(&p, ORDER_SPINS);
+}
+
+FORCE_INLINE void tm_order_pass(std::atomic<uint64_t> *turn, uint64_t order)
+{
+	turn->store(order + 1, std::memory_order_release);
+}
+
+/* Ends a TM_BEGIN block once the transactions before order committed */
+#define TM_END_ORDERED(turn, order)				\
+			tm_order_wait((turn), (order));		\
+			ring_tm_validate(tx);			\
+			ring_tm_commit(tx);			\
+			tm_order_pass((turn), (order));		\
+			TM_LEAVE(tx)				\
+			TM_STATS_END(tx)			\
+			TM_PROF_COMMIT(tx, tx->write_set->size())	\
+		}						\
+	}
+
+typedef void (*spec_body)(long i, void *arg, Tx_Context *tx);
+
+struct spec_pool
+{
+	int workers;				/* including the caller */
+	pthread_t threads[POOL_MAX_WORKERS];
+	std::atomic<uint32_t> generation;	/* bumped per loop */
+	std::atomic<int> finished;		/* workers done with this loop */
+	std::atomic<bool> stop;
+
+	/* the current loop */
+	long lo, hi;
+	spec_body fn;
+	void *arg;
+	std::atomic<long> next;			/* next iteration to hand out */
+	std::atomic<uint64_t> turn;		/* iteration allowed to commit */
+	std::atomic<long> aborts;		/* reruns in this loop */
+};
+
+inline spec_pool& tm_spec_pool()
+{
+	static spec_pool pool;
+	return pool;
+}
+
+inline void spec_run_loop(spec_pool& pool)
+{
+	TM_TX_VAR
+	long i, aborts = tx->aborts;
+
+	while ((i = pool.next.fetch_add(1, std::memory_order_relaxed)) < pool.hi) {
+		uint64_t order = i - pool.lo;
+
+		TM_BEGIN
+			pool.fn(i, pool.arg, tx);
+		TM_END_ORDERED(&pool.turn, order)
+	}
+	pool.aborts.fetch_add(tx->aborts - aborts, std::memory_order_relaxed);
+}
+
+inline void* spec_worker(void *args)
+{
+	spec_pool& pool = tm_spec_pool();
+	uint32_t seen = 0;
+
+	thread_init((int)(long)args);
+	for (;;) {
+		uint32_t gen;
+		tm_waiter w;
+
+		tm_wait_reset(&w);
+		while ((gen = pool.generation.load(std::memory_order_acquire)) == seen &&
+				!pool.stop.load(std::memory_order_acquire))
+			tm_wait(&w, &pool.generation, gen);
+		if (pool.stop.load(std::memory_order_acquire))
+			return 0;
+
+		seen = gen;
+		spec_run_loop(pool);
+		pool.finished.fetch_add(1, std::memory_order_acq_rel);
+		tm_wake(&pool.finished);
+	}
+}
+
+/* Starts workers - 1 threads, with thread ids first_id and up; the caller
+   is the last worker and must have called thread_init() itself */
+inline void spec_pool_init(int workers, int first_id)
+{
+	spec_pool& pool = tm_spec_pool();
+
+	pool.workers = workers < 1 ? 1 : workers > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : workers;
+	pool.generation.store(0, std::memory_order_relaxed);
+	pool.stop.store(false, std::memory_order_relaxed);
+	for (long t = 0; t < pool.workers - 1; t++)
+		pthread_create(&pool.threads[t], NULL, spec_worker, (void *)(first_id + t));
+}
+
+inline void spec_pool_stop()
+{
+	spec_pool& pool = tm_spec_pool();
+
+	pool.stop.store(true, std::memory_order_release);
+	tm_wake(&pool.generation);
+	for (int t = 0; t < pool.workers - 1; t++)
+		pthread_join(pool.threads[t], NULL);
+}
+
+/* fn(i) for i in [lo, hi), with the effect of running them in order;
+   returns the number of reruns */
+inline long parallel_for_speculative(long lo, long hi, spec_body fn, void *arg)
+{
+	spec_pool& pool = tm_spec_pool();
+
+	pool.lo = lo;
+	pool.hi = hi;
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.next.store(lo, std::memory_order_relaxed);
+	pool.turn.store(0, std::memory_order_relaxed);
+	pool.finished.store(0, std::memory_order_relaxed);
+	pool.aborts.store(0, std::memory_order_relaxed);
+	pool.generation.fetch_add(1, std::memory_order_acq_rel);
+	tm_wake(&pool.generation);
+
+	spec_run_loop(pool);
+
+	int done;
+	tm_waiter w;
+	tm_wait_reset(&w);
+	while ((done = pool.finished.load(std::memory_order_acquire)) != pool.workers - 1)
+		tm_wait(&w, &pool.finished, done);
+	return pool.aborts.load(std::memory_order_relaxed);
+}
+
+#endif //TM_ORDERED_HPP
@@ -0,0 +1,231 @@
+#ifndef TM_PROFILE_HPP
+#define TM_PROFILE_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include "stats.hpp"
+
+/**
+ *  Per-call-site transaction profiling (build with -DTM_PROFILE).
+ *
+ *  Every TM_BEGIN owns a static tm_site holding its __FILE__, __LINE__ and
+ *  function. The first transaction to run there hands the site an id.
+ *  Each thread counts into its own tm_prof_thread block, indexed by that
+ *  id, so there is no sharing while the program runs. tm_prof_report()
+ *  adds up the blocks of every thread and prints one row per site, with
+ *  the most cycles lost to aborted attempts first. Call it after the
+ *  worker threads have been joined.
+ *
+ *  Without -DTM_PROFILE the hooks expand to nothing, and the report only
+ *  says that profiling is off.
+ */
+
+#define TM_PROF_MAX_SITES	256
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+struct tm_site
+{
+	const char *file;
+	int line;
+	const char *func;
+	std::atomic<int> id;			/* -1 unregistered, -2 registering */
+};
+
+struct tm_site_stats
+{
+	uint64_t attempts;
+	uint64_t commits;
+	uint64_t aborts[ABORT_CAUSES];
+	uint64_t reads;				/* summed over committed attempts */
+	uint64_t writes;
+	uint64_t abort_cycles;			/* begin to abort, aborted attempts only */
+};
+
+struct tm_prof_thread
+{
+	tm_site_stats sites[TM_PROF_MAX_SITES];
+	tm_prof_thread *next;
+};
+
+/* Per transaction state, embedded in every Tx_Context */
+struct tm_prof_tx
+{
+	tm_prof_thread *block;
+	tm_site_stats *site;			/* stats of the running site */
+	uint64_t start;				/* tsc at the start of the attempt */
+	uint64_t reads;				/* reads in this attempt */
+};
+
+FORCE_INLINE uint64_t tm_prof_ticks()
+{
+	return __builtin_ia32_rdtsc();
+}
+
+inline std::atomic<int>& tm_prof_nsites()
+{
+	static std::atomic<int> nsites(0);
+	return nsites;
+}
+
+inline tm_site **tm_prof_sites()
+{
+	static tm_site *sites[TM_PROF_MAX_SITES];
+	return sites;
+}
+
+inline std::atomic<tm_prof_thread *>& tm_prof_threads()
+{
+	static std::atomic<tm_prof_thread *> threads(NULL);
+	return threads;
+}
+
+/* Slow path of the first transaction at a site; sites beyond the table
+   share the last slot. */
+inline int tm_prof_register(tm_site *site)
+{
+	int id = -1;
+
+	if (site->id.compare_exchange_strong(id, -2, std::memory_order_acq_rel)) {
+		id = tm_prof_nsites().fetch_add(1, std::memory_order_relaxed);
+		if (id >= TM_PROF_MAX_SITES)
+			id = TM_PROF_MAX_SITES - 1;
+		else
+			tm_prof_sites()[id] = site;
+		site->id.store(id, std::memory_order_release);
+		return id;
+	}
+
+	while ((id = site->id.load(std::memory_order_acquire)) < 0)
+		__builtin_ia32_pause();
+	return id;
+}
+
+inline tm_prof_thread *tm_prof_thread_block()
+{
+	tm_prof_thread *block = (tm_prof_thread *)calloc(1, sizeof(tm_prof_thread));
+	tm_prof_thread *head = tm_prof_threads().load(std::memory_order_relaxed);
+
+	do {
+		block->next = head;
+	} while (!tm_prof_threads().compare_exchange_weak(head, block,
+			std::memory_order_release, std::memory_order_relaxed));
+	return block;
+}
+
+FORCE_INLINE void tm_prof_enter(tm_prof_tx *p, tm_site *site)
+{
+	int id = site->id.load(std::memory_order_acquire);
+
+	if (__builtin_expect(id < 0, false))
+		id = tm_prof_register(site);
+	if (__builtin_expect(p->block == NULL, false))
+		p->block = tm_prof_thread_block();
+	p->site = &p->block->sites[id];
+}
+
+FORCE_INLINE void tm_prof_attempt(tm_prof_tx *p)
+{
+	p->site->attempts++;
+	p->reads = 0;
+	p->start = tm_prof_ticks();
+}
+
+FORCE_INLINE void tm_prof_commit(tm_prof_tx *p, uint64_t writes)
+{
+	p->site->commits++;
+	p->site->reads += p->reads;
+	p->site->writes += writes;
+}
+
+struct tm_prof_row
+{
+	tm_site *site;
+	tm_site_stats sum;
+};
+
+inline int tm_prof_cmp(const void *a, const void *b)
+{
+	uint64_t ca = ((const tm_prof_row *)a)->sum.abort_cycles;
+	uint64_t cb = ((const tm_prof_row *)b)->sum.abort_cycles;
+
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+inline void tm_prof_report(FILE *out)
+{
+#if defined(TM_PROFILE)
+	int n = tm_prof_nsites().load(std::memory_order_acquire);
+	tm_prof_row rows[TM_PROF_MAX_SITES];
+
+	if (n > TM_PROF_MAX_SITES)
+		n = TM_PROF_MAX_SITES;
+
+	for (int i = 0; i < n; i++) {
+		rows[i].site = tm_prof_sites()[i];
+		memset(&rows[i].sum, 0, sizeof(tm_site_stats));
+		for (tm_prof_thread *t = tm_prof_threads().load(std::memory_order_acquire); t; t = t->next) {
+			tm_site_stats *s = &t->sites[i];
+			rows[i].sum.attempts += s->attempts;
+			rows[i].sum.commits += s->commits;
+			for (int c = 0; c < ABORT_CAUSES; c++)
+				rows[i].sum.aborts[c] += s->aborts[c];
+			rows[i].sum.reads += s->reads;
+			rows[i].sum.writes += s->writes;
+			rows[i].sum.abort_cycles += s->abort_cycles;
+		}
+	}
+	qsort(rows, n, sizeof(tm_prof_row), tm_prof_cmp);
+
+	fprintf(out, "\n%-32s %10s %10s %10s %10s %10s %10s %8s %8s %14s\n", "site", "attempts",
+			"commits", "conflict", "locked", "overrun", "explicit", "reads", "writes", "abort cycles");
+	for (int i = 0; i < n; i++) {
+		tm_site_stats *s = &rows[i].sum;
+		char where[256];
+		double commits = s->commits ? (double)s->commits : 1;
+
+		snprintf(where, sizeof(where), "%s:%d %s", rows[i].site->file,
+				rows[i].site->line, rows[i].site->func);
+		fprintf(out, "%-32s %10llu %10llu %10llu %10llu %10llu %10llu %8.1f %8.1f %14llu\n", where,
+				(unsigned long long)s->attempts, (unsigned long long)s->commits,
+				(unsigned long long)s->aborts[ABORT_CONFLICT], (unsigned long long)s->aborts[ABORT_LOCKED],
+				(unsigned long long)s->aborts[ABORT_OVERRUN], (unsigned long long)s->aborts[ABORT_EXPLICIT],
+				s->reads / commits, s->writes / commits, (unsigned long long)s->abort_cycles);
+	}
+#else
+	fprintf(out, "profiling disabled, build with -DTM_PROFILE\n");
+#endif
+}
+
+#if defined(TM_PROFILE)
+
+FORCE_INLINE void tm_prof_abort(tm_prof_tx *p, int cause)
+{
+	p->site->aborts[cause]++;
+	p->site->abort_cycles += tm_prof_ticks() - p->start;
+}
+
+#define TM_PROF_BEGIN(tx)										\
+		static tm_site tm_site_here = { __FILE__, __LINE__, __func__, {-1} };	\
+		tm_prof_enter(&(tx)->prof, &tm_site_here);
+#define TM_PROF_ATTEMPT(tx)		tm_prof_attempt(&(tx)->prof);
+#define TM_PROF_READ(tx)		(tx)->prof.reads++;
+#define TM_PROF_COMMIT(tx, writes)	tm_prof_commit(&(tx)->prof, (writes));
+
+#else
+
+FORCE_INLINE void tm_prof_abort(tm_prof_tx *p, int cause) { }
+
+#define TM_PROF_BEGIN(tx)
+#define TM_PROF_ATTEMPT(tx)
+#define TM_PROF_READ(tx)
+#define TM_PROF_COMMIT(tx, writes)
+
+#endif
+
+#endif //TM_PROFILE_HPP
@@ -0,0 +1,52 @@
+#ifndef TM_RESULTS_HPP
+#define TM_RESULTS_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ *  Structured result records for the drivers (-o <file>).
+ *
+ *  Every run appends one tab-separated line:
+ *
+ *    engine  config  threads  host  unix-time  throughput  per-thread,...
+ *
+ *  engine is the build (ring, part, tl2, kcas, ...). config is the
+ *  options that change the workload, written as key=value pairs. Runs
+ *  with the same engine, config and threads are repeated trials of one
+ *  experiment. benchcmp compares such groups between two record files.
+ *
+ *  The file is opened in append mode and the line goes out in a single
+ *  fwrite, so concurrent drivers do not interleave their records.
+ */
+
+#define RESULT_LINE_MAX	4096
+
+/* Appends a record; false if the file cannot be written */
+inline bool result_append(const char *path, const char *engine, const char *config,
+		unsigned int threads, unsigned long long throughput,
+		const unsigned long long *per_thread)
+{
+	char line[RESULT_LINE_MAX];
+	char host[256] = "unknown";
+	int len;
+
+	gethostname(host, sizeof(host) - 1);
+	len = snprintf(line, sizeof(line), "%s\t%s\t%u\t%s\t%ld\t%llu\t", engine, config,
+			threads, host, (long)time(NULL), throughput);
+	for (unsigned int i = 0; i < threads && len < RESULT_LINE_MAX; i++)
+		len += snprintf(line + len, sizeof(line) - len, i ? ",%llu" : "%llu", per_thread[i]);
+	if (len >= RESULT_LINE_MAX - 1)
+		len = RESULT_LINE_MAX - 2;
+	line[len++] = '\n';
+
+	FILE *f = fopen(path, "a");
+	if (!f)
+		return false;
+	bool ok = fwrite(line, 1, len, f) == (size_t)len;
+	return fclose(f) == 0 && ok;
+}
+
+#endif //TM_RESULTS_HPP
@@ -0,0 +1,15 @@
+#include "ring_part_stm.hpp"
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+__thread Tx_Context* Self;
+
+
+struct ring_partition rings[NUM_PARTITIONS];
+uintptr_t part_base = 0;
+unsigned int part_shift = 8 * sizeof(uintptr_t) - 1;	/* one partition until a range is set */
@@ -0,0 +1,359 @@
+#ifndef RING_PART_TM_HPP
+#define RING_PART_TM_HPP 1
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <atomic>
+#include "rand_r_32.h"
+#include "WriteSet.hpp"
+#include "BitFilter.h"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+
+/**
+ *  Partitioned RingSTM.
+ *
+ *  The address range registered with tm_partition_range() is cut into
+ *  NUM_PARTITIONS equal slices, and every slice gets its own ring with its
+ *  own ring_index. A transaction only looks at the rings of the partitions
+ *  it has touched, so transactions that stay inside one partition never
+ *  read or write another ring.
+ *
+ *  Writers take the commit lock of every touched ring in ascending
+ *  partition order, validate, append one entry per written ring and write
+ *  back. Holding the locks makes the validation final and keeps write-backs
+ *  to the same ring ordered. Rings are reused modulo PART_RING_SIZE; a
+ *  transaction that falls a whole ring behind aborts.
+ */
+
+#define FILTER_SIZE 4096
+#define ACCESS_SIZE 102400
+#define NUM_PARTITIONS 8			/* at most 64, one bit per partition */
+#define PART_RING_SIZE 4096			/* entries per ring, power of two */
+#define PART_RING_MASK (PART_RING_SIZE - 1)
+
+#define COMPLETE 0
+#define WRITING 1
+
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#define CACHELINE_BYTES 64
+#define CFENCE __asm__ volatile ("":::"memory")
+
+using stm::WriteSetEntry;
+using stm::WriteSet;
+
+typedef struct ring_entry
+{
+	std::atomic<uint64_t> time_stamp; 		/* commit timestamp */
+	BitFilter<FILTER_SIZE> write_filter;		/* write filter */
+	std::atomic<int> status;			/* writing or complete */
+} ring_entry_t;
+
+struct ring_partition
+{
+	std::atomic<uint64_t> ring_index;		/* newest entry of this ring */
+	char pad1[CACHELINE_BYTES - sizeof(uint64_t)];
+	std::atomic<uint64_t> lock;			/* commit lock of this ring */
+	char pad2[CACHELINE_BYTES - sizeof(uint64_t)];
+	ring_entry_t *ring;				/* the entries */
+	char pad3[CACHELINE_BYTES - sizeof(ring_entry_t *)];
+};
+
+struct Tx_Context
+{
+	int id;
+	jmp_buf scope;
+	WriteSet *write_set;		 			/* speculative writes */
+	uint64_t parts;					/* partitions touched */
+	uint64_t read_parts;				/* partitions read */
+	uint64_t write_parts;				/* partitions written */
+	uint64_t locked;				/* ring locks held at commit */
+	uint64_t start[NUM_PARTITIONS];			/* logical start time per ring */
+	BitFilter<FILTER_SIZE> write_filter[NUM_PARTITIONS];	/* addresses to write */
+	BitFilter<FILTER_SIZE> read_filter[NUM_PARTITIONS]; 	/* addresses to read */
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
+	long commits =0, aborts =0;
+};
+
+extern __thread Tx_Context* Self;
+
+extern struct ring_partition rings[NUM_PARTITIONS];	/* one ring per partition */
+extern uintptr_t part_base;		/* first byte of the partitioned range */
+extern unsigned int part_shift;		/* log2 of the bytes per partition */
+
+
+#define TM_TX_VAR Tx_Context* tx = (Tx_Context*)Self;
+
+inline unsigned long long get_real_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
+	for (int p = 0; p < NUM_PARTITIONS; p++) {
+		rings[p].ring_index.store(0, std::memory_order_relaxed);
+		rings[p].lock.store(0, std::memory_order_relaxed);
+		rings[p].ring = (ring_entry_t*) malloc(sizeof(ring_entry_t) * PART_RING_SIZE);
+		for (int i = 0; i < PART_RING_SIZE; i++) {
+			rings[p].ring[i].time_stamp.store(0, std::memory_order_relaxed);
+			rings[p].ring[i].write_filter.clear();
+			rings[p].ring[i].status.store(COMPLETE, std::memory_order_relaxed);
+		}
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+/* Split [base, base + len) into NUM_PARTITIONS slices. Addresses outside
+   the range belong to partition 0. */
+FORCE_INLINE void tm_partition_range(void *base, size_t len)
+{
+	size_t slice = (len + NUM_PARTITIONS - 1) / NUM_PARTITIONS;
+
+	part_shift = 0;
+	while (((size_t)1 << part_shift) < slice)
+		part_shift++;
+	part_base = (uintptr_t)base;
+}
+
+FORCE_INLINE int ring_part_of(const void *addr)
+{
+	uintptr_t p = ((uintptr_t)addr - part_base) >> part_shift;
+	return p < NUM_PARTITIONS ? (int)p : 0;
+}
+
+FORCE_INLINE void ring_part_unlock(Tx_Context *tx)
+{
+	for (int p = 0; p < NUM_PARTITIONS; p++)
+		if (tx->locked & (1ULL << p)) {
+			rings[p].lock.store(0, std::memory_order_release);
+			tm_wake(&rings[p].lock);
+		}
+	tx->locked = 0;
+}
+
+FORCE_INLINE void ring_part_abort(Tx_Context *tx, int cause)
+{
+	ring_part_unlock(tx);
+	tx->aborts++;
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
+	longjmp(tx->scope, 1);
+}
+
+/* Only the newest entry of a ring can be WRITING, since writers hold the
+   ring lock until they complete. */
+FORCE_INLINE uint64_t ring_part_start(struct ring_partition *rp)
+{
+	uint64_t start = rp->ring_index.load(std::memory_order_acquire);
+	if (rp->ring[start & PART_RING_MASK].status.load(std::memory_order_acquire) != COMPLETE)
+		start--;
+	return start;
+}
+
+/* First access to partition p: pick a start time on its ring */
+FORCE_INLINE void ring_part_touch(Tx_Context *tx, int p)
+{
+	uint64_t bit = 1ULL << p;
+
+	if (tx->parts & bit)
+		return;
+
+	tx->write_filter[p].clear();
+	tx->read_filter[p].clear();
+	tx->start[p] = ring_part_start(&rings[p]);
+	tx->parts |= bit;
+}
+
+FORCE_INLINE void ring_part_validate(Tx_Context *tx, int p)
+{
+	struct ring_partition *rp = &rings[p];
+	uint64_t end = rp->ring_index.load(std::memory_order_acquire);
+
+	tm_stats_lag(tx->stats, end - tx->start[p]);
+	if (end == tx->start[p])
+		return;
+
+	if (end - tx->start[p] >= PART_RING_SIZE - 1)
+		ring_part_abort(tx, ABORT_OVERRUN);
+
+	uint64_t suffix_end = end;
+
+	for (uint64_t i = end; i > tx->start[p]; i--)
+	{
+		ring_entry_t *entry = &rp->ring[i & PART_RING_MASK];
+
+		if (entry->write_filter.intersect(&tx->read_filter[p]))
+			ring_part_abort(tx, ABORT_CONFLICT);
+
+		if (entry->status.load(std::memory_order_relaxed) == WRITING)
+			suffix_end = i-1;
+	}
+
+	/* the entries we scanned must not have been recycled meanwhile */
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (rp->ring_index.load(std::memory_order_relaxed) - tx->start[p] >= PART_RING_SIZE - 1)
+		ring_part_abort(tx, ABORT_OVERRUN);
+
+	tx->start[p] = suffix_end;
+}
+
+FORCE_INLINE void ring_part_validate_all(Tx_Context *tx)
+{
+	uint64_t parts = tx->read_parts;
+
+	while (parts) {
+		int p = __builtin_ctzll(parts);
+		ring_part_validate(tx, p);
+		parts &= parts - 1;
+	}
+}
+
+FORCE_INLINE void ring_part_write(uint64_t *addr, uint64_t val, Tx_Context *tx)
+{
+	int p = ring_part_of(addr);
+
+	ring_part_touch(tx, p);
+	tx->write_set->insert(WriteSetEntry((void**)addr, *((uint64_t*)(&val))));
+	tx->write_filter[p].add(addr);
+	tx->write_parts |= 1ULL << p;
+}
+
+FORCE_INLINE uint64_t ring_part_read(uint64_t *addr, Tx_Context *tx)
+{
+	uint64_t val;
+	int p = ring_part_of(addr);
+
+	if (tx->write_parts & (1ULL << p)) {
+		WriteSetEntry log((void **)addr);
+		if (tx->write_filter[p].lookup(addr) && tx->write_set->find(log))
+			return log.val;
+	}
+
+	ring_part_touch(tx, p);
+
+	val = *addr;
+
+	tx->read_filter[p].add(addr);
+	TM_PROF_READ(tx)
+	tx->read_parts |= 1ULL << p;
+
+	/* the value must be read before the rings are checked */
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	ring_part_validate_all(tx);
+
+	return val;
+}
+
+#define TM_READ(var)	ring_part_read(&var, tx)
+#define TM_WRITE(var, val) ring_part_write(&var, val, tx)
+
+FORCE_INLINE void ring_part_commit(Tx_Context *tx)
+{
+	if (tx->write_set->size() == 0)
+		return;
+
+	/* lock every touched ring in partition order */
+	uint64_t parts = tx->parts;
+	while (parts) {
+		int p = __builtin_ctzll(parts);
+		tm_waiter w;
+
+		tm_wait_reset(&w);
+		uint64_t unlocked = 0;
+		while (!rings[p].lock.compare_exchange_weak(unlocked, 1,
+				std::memory_order_acquire, std::memory_order_relaxed)) {
+			tm_wait(&w, &rings[p].lock, 1);
+			unlocked = 0;
+		}
+		tx->locked |= 1ULL << p;
+		parts &= parts - 1;
+	}
+
+	ring_part_validate_all(tx);
+
+	/* publish one entry per written ring before writing back */
+	parts = tx->write_parts;
+	while (parts) {
+		int p = __builtin_ctzll(parts);
+		uint64_t commit_time = rings[p].ring_index.load(std::memory_order_relaxed) + 1;
+		ring_entry_t *entry = &rings[p].ring[commit_time & PART_RING_MASK];
+
+		entry->status.store(WRITING, std::memory_order_relaxed);
+		entry->write_filter = tx->write_filter[p];
+		entry->time_stamp.store(commit_time, std::memory_order_relaxed);
+		rings[p].ring_index.store(commit_time, std::memory_order_release);
+		parts &= parts - 1;
+	}
+
+	/* the entries must be visible before any of the new values */
+	std::atomic_thread_fence(std::memory_order_release);
+
+	/* write back */
+	tx->write_set->writeback();
+
+	parts = tx->write_parts;
+	while (parts) {
+		int p = __builtin_ctzll(parts);
+		uint64_t commit_time = rings[p].ring_index.load(std::memory_order_relaxed);
+		rings[p].ring[commit_time & PART_RING_MASK].status.store(COMPLETE, std::memory_order_release);
+		parts &= parts - 1;
+	}
+
+	ring_part_unlock(tx);
+
+	tx->commits++;
+}
+
+FORCE_INLINE void thread_init(int id)
+{
+	if (!Self)
+	{
+		Self = new Tx_Context();
+		Tx_Context *tx = (Tx_Context *)Self;
+		tx->id = id;
+		tx->write_set = new WriteSet(ACCESS_SIZE);
+		tx->stats = tm_stats_register(id);
+	}
+}
+
+#define TM_BEGIN												\
+	{															\
+		Tx_Context *tx = (Tx_Context *)Self;					\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
+		{														\
+			TM_PROF_ATTEMPT(tx)									\
+			tx->write_set->reset();								\
+			tx->parts = 0;										\
+			tx->read_parts = 0;									\
+			tx->write_parts = 0;								\
+			tx->locked = 0;
+
+#define TM_END							\
+			ring_part_commit(tx);		\
+			TM_LEAVE(tx)		\
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->write_set->size())	\
+		}								\
+	}
+
+#endif //RING_PART_TM_HPP
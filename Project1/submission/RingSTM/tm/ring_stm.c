@@ -14,7 +14,7 @@ __thread Tx_Context* Self;
 
 
 struct ring_entry *ring;
-uint64_t ring_index = 0;
+std::atomic<uint64_t> ring_index(0);
 
 long int    FALSE = 0,
     TRUE  = 1;
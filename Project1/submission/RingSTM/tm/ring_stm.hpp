@@ -16,13 +16,19 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include "rand_r_32.h"
 #include "WriteSet.hpp"
 #include "BitFilter.h"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
 
 #define FILTER_SIZE 4096
 #define ACCESS_SIZE 102400
-#define RING_SIZE 1048576
+#define RING_SIZE 1048576			/* power of two, entries are reused */
+#define RING_MASK (RING_SIZE - 1)
 
 #define COMPLETE 0
 #define WRITING 1
@@ -30,18 +36,20 @@
 #define FORCE_INLINE __attribute__((always_inline)) inline
 #define CACHELINE_BYTES 64
 #define CFENCE __asm__ volatile ("":::"memory")
-#define MFENCE __asm__ volatile ("mfence":::"memory")
 
-#define nop()       __asm__ volatile("nop")
+/* how an abort gets back to the start; the libitm layer overrides it */
+#ifndef TM_RESTART
+#define TM_RESTART(tx)	longjmp((tx)->scope, 1)
+#endif
 
 using stm::WriteSetEntry;
 using stm::WriteSet;
 
 typedef struct ring_entry
 {
-	uint64_t time_stamp; 					/* commit timestamp */
+	std::atomic<uint64_t> time_stamp; 		/* commit timestamp */
 	BitFilter<FILTER_SIZE> write_filter;		/* write filter */
-	int status;							/* writing or complete */
+	std::atomic<int> status;				/* writing or complete */
 } ring_entry_t;
 
 struct Tx_Context
@@ -52,13 +60,15 @@ struct Tx_Context
 	BitFilter<FILTER_SIZE> write_filter;		/* addresses to write */
 	BitFilter<FILTER_SIZE> read_filter; 		/* addresses to read */
 	uint64_t start;					/* logical start time */
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
 	long commits =0, aborts =0;
 };
 
 extern __thread Tx_Context* Self;
 
 extern struct ring_entry *ring;		/* the global ring */
-extern uint64_t ring_index;		/* newest ring entry */
+extern std::atomic<uint64_t> ring_index;	/* newest ring entry */
 
 
 #define TM_TX_VAR Tx_Context* tx = (Tx_Context*)Self;
@@ -71,45 +81,66 @@ inline unsigned long long get_real_time()
 	return time.tv_sec * 1000000000L + time.tv_nsec;
 }
 
-FORCE_INLINE void spin64() {
-	for (int i = 0; i < 64; i++)
-		nop();
-}
-
 FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
 	ring = (struct ring_entry*) malloc(sizeof(struct ring_entry) * RING_SIZE);
 	for (int i=0; i < RING_SIZE; i++) {
-		ring[i].time_stamp = 0;
+		ring[i].time_stamp.store(0, std::memory_order_relaxed);
 		ring[i].write_filter.clear();
-		ring[i].status = COMPLETE;	
+		ring[i].status.store(COMPLETE, std::memory_order_relaxed);
 	}
+	std::atomic_thread_fence(std::memory_order_release);
 }
 
-FORCE_INLINE void ring_tm_abort(Tx_Context *tx, int explicitly)
+FORCE_INLINE void ring_tm_abort(Tx_Context *tx, int cause)
 {
 	tx->aborts++;
-	longjmp(tx->scope, 1);
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
+	TM_RESTART(tx);
+}
+
+/* An entry's filter is only valid once its timestamp is published */
+FORCE_INLINE void ring_tm_wait_entry(uint64_t i)
+{
+	uint64_t ts;
+	tm_waiter w;
+
+	tm_wait_reset(&w);
+	while ((ts = ring[i & RING_MASK].time_stamp.load(std::memory_order_acquire)) < i)
+		tm_wait(&w, &ring[i & RING_MASK].time_stamp, (uint32_t)ts);
 }
 
 FORCE_INLINE void ring_tm_validate(Tx_Context *tx)
 {
-	if (ring_index == tx->start)
+	uint64_t end = ring_index.load(std::memory_order_acquire);
+
+	tm_stats_lag(tx->stats, end - tx->start);
+	if (end == tx->start)
 		return;
 
-	uint64_t suffix_end = ring_index;
+	/* the ring has wrapped past our start */
+	if (end - tx->start >= RING_SIZE - 1)
+		ring_tm_abort(tx, ABORT_OVERRUN);
 
-	while (ring[suffix_end].time_stamp < suffix_end)
-		spin64();
+	uint64_t suffix_end = end;
 
-	for (uint64_t i = ring_index; i >= (unsigned long)tx->start + 1; i--)
+	for (uint64_t i = end; i >= (unsigned long)tx->start + 1; i--)
 	{
-		if (ring[i].write_filter.intersect(&tx->read_filter))
-			ring_tm_abort(tx, 0);
+		ring_tm_wait_entry(i);
+
+		if (ring[i & RING_MASK].write_filter.intersect(&tx->read_filter))
+			ring_tm_abort(tx, ABORT_CONFLICT);
 
-		if (ring[i].status == WRITING)
+		if (ring[i & RING_MASK].status.load(std::memory_order_acquire) == WRITING)
 			suffix_end = i-1;
 	}
 
+	/* the entries we scanned must not have been reused meanwhile */
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (ring_index.load(std::memory_order_relaxed) - tx->start >= RING_SIZE - 1)
+		ring_tm_abort(tx, ABORT_OVERRUN);
+
 	tx->start = suffix_end;
 }
 
@@ -132,8 +163,10 @@ FORCE_INLINE uint64_t ring_tm_read(uint64_t *addr, Tx_Context *tx)
 	val = *addr;
 	
 	tx->read_filter.add(addr);
+	TM_PROF_READ(tx)
 
-	CFENCE;
+	/* the value must be read before the ring is checked */
+	std::atomic_thread_fence(std::memory_order_acquire);
 
 	ring_tm_validate(tx);
 
@@ -143,26 +176,51 @@ FORCE_INLINE uint64_t ring_tm_read(uint64_t *addr, Tx_Context *tx)
 #define TM_READ(var)	ring_tm_read(&var, tx)
 #define TM_WRITE(var, val) ring_tm_write(&var, val, tx)
 
+/* copy-on-write for online dumps, see snapshot.hpp */
+inline void ring_snapshot_cow(Tx_Context *tx, uint64_t ts);
+
 FORCE_INLINE void ring_tm_commit(Tx_Context *tx)
 {
 	if (tx->write_set->size() == 0)
 		return;
 again:
-	uint64_t commit_time = ring_index;
+	uint64_t commit_time = ring_index.load(std::memory_order_acquire);
 
 	ring_tm_validate(tx);
 
-	if (!__sync_bool_compare_and_swap(&ring_index,commit_time, commit_time + 1))
+	/* seq_cst: a dumper sets its flag and then reads ring_index, we bump
+	   ring_index and then read the flag; one of us must see the other */
+	if (!ring_index.compare_exchange_strong(commit_time, commit_time + 1,
+			std::memory_order_seq_cst, std::memory_order_relaxed))
 		goto again;
 
-	ring[commit_time + 1].status = WRITING;
-	ring[commit_time + 1].write_filter = tx->write_filter;
-	ring[commit_time + 1].time_stamp = commit_time + 1;
+	ring_entry_t *entry = &ring[(commit_time + 1) & RING_MASK];
+	ring_entry_t *prev = &ring[commit_time & RING_MASK];
+
+	entry->status.store(WRITING, std::memory_order_relaxed);
+	entry->write_filter = tx->write_filter;
+	entry->time_stamp.store(commit_time + 1, std::memory_order_release);
+	tm_wake(&entry->time_stamp);
+
+	/* the entry must be visible before any of the new values */
+	std::atomic_thread_fence(std::memory_order_release);
+
+	ring_snapshot_cow(tx, commit_time + 1);
 
 	/* write back */
 	tx->write_set->writeback();
 
-	ring[commit_time + 1].status = COMPLETE;
+	/* entries complete in ring order, so a COMPLETE entry means every older
+	   one is complete too and TM_BEGIN may start from it */
+	int status;
+	tm_waiter w;
+
+	tm_wait_reset(&w);
+	while ((status = prev->status.load(std::memory_order_acquire)) != COMPLETE)
+		tm_wait(&w, &prev->status, (uint32_t)status);
+
+	entry->status.store(COMPLETE, std::memory_order_release);
+	tm_wake(&entry->status);
 
 	tx->commits++;
 }
@@ -175,26 +233,48 @@ FORCE_INLINE void thread_init(int id)
 		Tx_Context *tx = (Tx_Context *)Self;
 		tx->id = id;
 		tx->write_set = new WriteSet(ACCESS_SIZE);
+		tx->stats = tm_stats_register(id);
+	}
+}
+
+/* Starts an attempt from the newest ring entry that is complete */
+FORCE_INLINE void ring_tm_begin(Tx_Context *tx)
+{
+	tx->write_set->reset();
+	tx->write_filter.clear();
+	tx->read_filter.clear();
+	tx->start = ring_index.load(std::memory_order_acquire);
+
+	/* the timestamp first: it is published after WRITING, so a status
+	   read behind it cannot be the COMPLETE of the slot's previous entry */
+	for (;;) {
+		ring_entry_t *entry = &ring[tx->start & RING_MASK];
+		if (entry->time_stamp.load(std::memory_order_acquire) >= tx->start &&
+				entry->status.load(std::memory_order_acquire) == COMPLETE)
+			break;
+		tx->start--;
 	}
 }
 
 #define TM_BEGIN												\
 	{															\
 		Tx_Context *tx = (Tx_Context *)Self;					\
-		uint32_t abort_flags = _setjmp(tx->scope);				\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
 		{														\
-			tx->write_set->reset();								\
-			tx->write_filter.clear();							\
-			tx->read_filter.clear();							\
-			tx->start = ring_index;								\
-																\
-			while (ring[tx->start].status != COMPLETE ||		\
-					ring[tx->start].time_stamp < tx->start ) 	\
-				tx->start--;
+			TM_PROF_ATTEMPT(tx)									\
+			ring_tm_begin(tx);
 
 #define TM_END							\
 			ring_tm_commit(tx);			\
+			TM_LEAVE(tx)			\
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->write_set->size())	\
 		}								\
 	}
 
+#include "snapshot.hpp"
+
 #endif //RING_TM_HPP
@@ -0,0 +1,267 @@
+#ifndef TM_SNAPSHOT_HPP
+#define TM_SNAPSHOT_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+
+/**
+ *  Consistent online dumps of a region for RingSTM (included by
+ *  ring_stm.hpp).
+ *
+ *  tm_snapshot_dump() picks the current ring index as the image time. It
+ *  waits until every commit up to that time has written back, then
+ *  streams the region to a file in SNAP_STRIPE_BYTES chunks while
+ *  transactions keep committing. A stripe is dumped once per image: the
+ *  dumper claims it, copies it to a private buffer, releases it and only
+ *  then writes the buffer, so no writer waits on file I/O.
+ *
+ *  A writer that commits after the image time and is about to write into
+ *  a stripe nobody has claimed yet copies the stripe aside first
+ *  (copy-on-write). The dumper then writes that copy instead. A writer
+ *  only waits when it hits a stripe someone else is copying at that
+ *  moment.
+ *
+ *  Stripe words hold generation << 2 | state. A word left over from an
+ *  older dump counts as untouched, so nothing is reset between dumps.
+ */
+
+#define SNAP_STRIPE_BYTES	4096		/* a page */
+#define SNAP_MAGIC		0x534e4150	/* "SNAP" */
+
+#define SNAP_LIVE		0		/* not dumped yet in this generation */
+#define SNAP_BUSY		1		/* being copied or written */
+#define SNAP_SAVED		2		/* pre-image in saved[] */
+#define SNAP_DONE		3		/* written to the file */
+
+struct snapshot_state
+{
+	std::atomic<int> active;		/* a dump is running */
+	std::atomic<uint64_t> gen;		/* generation of the running dump */
+	std::atomic<uint64_t> ready;		/* gen once time is set */
+	uint64_t time;				/* ring index the image is taken at */
+	uintptr_t base;				/* the region */
+	size_t len;
+	size_t nstripes;
+	std::atomic<uint64_t> *stripes;
+	char **saved;
+	std::atomic<long> cow_stripes;		/* copied by writers, for reports */
+};
+
+struct snapshot_header
+{
+	uint32_t magic;
+	uint32_t stripe_bytes;
+	uint64_t time;				/* ring index of the image */
+	uint64_t bytes;				/* of data that follows */
+};
+
+struct snapshot_report
+{
+	uint64_t bytes;
+	uint64_t nsec;
+	uint64_t time;
+	long cow_stripes;			/* stripes writers had to copy */
+	uint64_t checksum;			/* sum of the 64-bit words dumped */
+};
+
+inline snapshot_state& tm_snapshot()
+{
+	static snapshot_state state;
+	return state;
+}
+
+/* Registers the region dumps will cover; call before the threads start */
+inline void tm_snapshot_init(void *base, size_t len)
+{
+	snapshot_state& s = tm_snapshot();
+
+	s.base = (uintptr_t)base;
+	s.len = len;
+	s.nstripes = (len + SNAP_STRIPE_BYTES - 1) / SNAP_STRIPE_BYTES;
+	s.stripes = new std::atomic<uint64_t>[s.nstripes];
+	s.saved = (char **)calloc(s.nstripes, sizeof(char *));
+	for (size_t i = 0; i < s.nstripes; i++)
+		s.stripes[i].store(0, std::memory_order_relaxed);
+	s.gen.store(0, std::memory_order_relaxed);
+	s.active.store(0, std::memory_order_release);
+}
+
+/* Every commit up to time has written back; completion is in ring order */
+inline void snap_wait_complete(uint64_t time)
+{
+	ring_entry_t *entry = &ring[time & RING_MASK];
+	tm_waiter w;
+
+	tm_wait_reset(&w);
+	for (;;) {
+		uint64_t stamp = entry->time_stamp.load(std::memory_order_acquire);
+		int status = entry->status.load(std::memory_order_acquire);
+		if (stamp > time || (stamp == time && status == COMPLETE))
+			return;
+		tm_wait(&w, &entry->status, (uint32_t)status);
+	}
+}
+
+FORCE_INLINE size_t snap_stripe_bytes(snapshot_state& s, size_t i)
+{
+	size_t left = s.len - i * SNAP_STRIPE_BYTES;
+	return left < SNAP_STRIPE_BYTES ? left : SNAP_STRIPE_BYTES;
+}
+
+/* Called by a committer after it got commit time ts and before write-back */
+inline void ring_snapshot_cow(Tx_Context *tx, uint64_t ts)
+{
+	snapshot_state& s = tm_snapshot();
+
+	/* pairs with the dumper setting active before it reads ring_index */
+	if (__builtin_expect(!s.active.load(std::memory_order_seq_cst), true))
+		return;
+
+	uint64_t gen = s.gen.load(std::memory_order_acquire);
+	while (s.ready.load(std::memory_order_acquire) < gen)
+		cpu_relax();
+	if (ts <= s.time)
+		return;
+
+	bool waited = false;
+	for (WriteSet::iterator i = tx->write_set->begin(), e = tx->write_set->end(); i != e; ++i) {
+		uintptr_t off = (uintptr_t)i->addr - s.base;
+		if (off >= s.len)
+			continue;
+
+		size_t idx = off / SNAP_STRIPE_BYTES;
+		std::atomic<uint64_t> *word = &s.stripes[idx];
+		uint64_t cur = word->load(std::memory_order_acquire);
+		tm_waiter w;
+
+		tm_wait_reset(&w);
+		for (;;) {
+			if ((cur >> 2) < gen) {
+				/* copy only what every commit up to the image time left */
+				if (!waited) {
+					snap_wait_complete(s.time);
+					waited = true;
+				}
+				if (!word->compare_exchange_weak(cur, gen << 2 | SNAP_BUSY,
+						std::memory_order_acq_rel, std::memory_order_acquire))
+					continue;
+
+				size_t bytes = snap_stripe_bytes(s, idx);
+				s.saved[idx] = (char *)malloc(bytes);
+				memcpy(s.saved[idx], (char *)s.base + idx * SNAP_STRIPE_BYTES, bytes);
+				s.cow_stripes.fetch_add(1, std::memory_order_relaxed);
+				word->store(gen << 2 | SNAP_SAVED, std::memory_order_release);
+				tm_wake(word);
+				break;
+			}
+			if ((cur >> 2) == gen && (cur & 3) == SNAP_BUSY) {
+				tm_wait(&w, word, (uint32_t)cur);
+				cur = word->load(std::memory_order_acquire);
+				continue;
+			}
+			break;
+		}
+	}
+}
+
+FORCE_INLINE uint64_t snap_sum(const char *data, size_t bytes)
+{
+	const uint64_t *words = (const uint64_t *)data;
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < bytes / sizeof(uint64_t); i++)
+		sum += words[i];
+	return sum;
+}
+
+FORCE_INLINE bool snap_write(int fd, const char *data, size_t bytes)
+{
+	while (bytes) {
+		ssize_t n = write(fd, data, bytes);
+		if (n <= 0)
+			return false;
+		data += n;
+		bytes -= n;
+	}
+	return true;
+}
+
+/* Dumps a consistent image of the registered region to path while the
+   workers run. One dump at a time. Returns false on I/O errors. */
+inline bool tm_snapshot_dump(const char *path, snapshot_report *report)
+{
+	snapshot_state& s = tm_snapshot();
+	unsigned long long start = get_real_time();
+	uint64_t gen = s.gen.load(std::memory_order_relaxed) + 1;
+	long cow_before = s.cow_stripes.load(std::memory_order_relaxed);
+	char *buf = (char *)malloc(SNAP_STRIPE_BYTES);
+	bool ok = true;
+
+	s.gen.store(gen, std::memory_order_relaxed);
+	s.active.store(1, std::memory_order_seq_cst);
+	s.time = ring_index.load(std::memory_order_seq_cst);
+	s.ready.store(gen, std::memory_order_release);
+	snap_wait_complete(s.time);
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		ok = false;
+
+	snapshot_header header = { SNAP_MAGIC, SNAP_STRIPE_BYTES, s.time, s.len };
+	if (ok)
+		ok = snap_write(fd, (const char *)&header, sizeof(header));
+
+	report->checksum = 0;
+	for (size_t idx = 0; idx < s.nstripes; idx++) {
+		std::atomic<uint64_t> *word = &s.stripes[idx];
+		size_t bytes = snap_stripe_bytes(s, idx);
+		uint64_t cur = word->load(std::memory_order_acquire);
+		tm_waiter w;
+
+		tm_wait_reset(&w);
+		for (;;) {
+			if ((cur >> 2) < gen) {
+				if (!word->compare_exchange_weak(cur, gen << 2 | SNAP_BUSY,
+						std::memory_order_acq_rel, std::memory_order_acquire))
+					continue;
+				memcpy(buf, (const char *)s.base + idx * SNAP_STRIPE_BYTES, bytes);
+				word->store(gen << 2 | SNAP_DONE, std::memory_order_release);
+				tm_wake(word);
+				break;
+			}
+			if ((cur & 3) == SNAP_BUSY) {
+				tm_wait(&w, word, (uint32_t)cur);
+				cur = word->load(std::memory_order_acquire);
+				continue;
+			}
+			/* a writer saved the pre-image for us */
+			memcpy(buf, s.saved[idx], bytes);
+			free(s.saved[idx]);
+			s.saved[idx] = NULL;
+			word->store(gen << 2 | SNAP_DONE, std::memory_order_release);
+			break;
+		}
+		report->checksum += snap_sum(buf, bytes);
+		if (ok)
+			ok = snap_write(fd, buf, bytes);
+	}
+
+	s.active.store(0, std::memory_order_release);
+	free(buf);
+	if (fd >= 0 && close(fd) != 0)
+		ok = false;
+
+	report->bytes = s.len;
+	report->nsec = get_real_time() - start;
+	report->time = s.time;
+	report->cow_stripes = s.cow_stripes.load(std::memory_order_relaxed) - cow_before;
+	return ok;
+}
+
+#endif //TM_SNAPSHOT_HPP
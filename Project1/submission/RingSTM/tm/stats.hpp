@@ -0,0 +1,191 @@
+#ifndef TM_STATS_HPP
+#define TM_STATS_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <atomic>
+
+/**
+ *  Live per-thread statistics in a shared-memory segment.
+ *
+ *  tm_sys_init() creates /dev/shm/stm_stats.<pid>; every thread claims one
+ *  slot in it from thread_init() and keeps its counters there. A thread is
+ *  the only writer of its slot, so updates are plain relaxed stores on a
+ *  line nobody else writes. stmtop maps the segment read-only and turns
+ *  the counters into rates, so a running process can be watched without
+ *  attaching to it. Build with -DTM_NO_STATS to compile the hooks out.
+ */
+
+#define STATS_MAGIC		0x53544d53	/* "STMS" */
+#define STATS_VERSION		1
+#define STATS_MAX_THREADS	256
+#define STATS_NAME_FMT		"/stm_stats.%d"
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+enum tm_abort_cause
+{
+	ABORT_CONFLICT = 0,		/* validation found a conflicting write */
+	ABORT_LOCKED,			/* a lock we needed was held */
+	ABORT_OVERRUN,			/* the ring wrapped past our start */
+	ABORT_EXPLICIT,			/* the program asked for it */
+	ABORT_CAUSES
+};
+
+struct tm_thread_stats
+{
+	std::atomic<uint64_t> commits;
+	std::atomic<uint64_t> aborts[ABORT_CAUSES];
+	std::atomic<uint64_t> retries;		/* attempts of the current tx so far */
+	std::atomic<uint64_t> ring_lag;		/* ring entries behind at last check */
+	std::atomic<uint64_t> tx_start_ns;	/* start of the current tx, 0 if idle */
+	std::atomic<int32_t> id;		/* thread id, -1 while unused */
+	char pad[2 * 64 - (ABORT_CAUSES + 4) * sizeof(uint64_t) - sizeof(int32_t)];
+};
+
+struct tm_stats_segment
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t max_threads;
+	std::atomic<uint32_t> live;		/* cleared when the process exits */
+	std::atomic<uint32_t> nthreads;		/* slots handed out */
+	char pad[64 - 5 * sizeof(uint32_t)];
+	tm_thread_stats threads[STATS_MAX_THREADS];
+};
+
+inline tm_stats_segment*& tm_stats_seg()
+{
+	static tm_stats_segment *seg = NULL;
+	return seg;
+}
+
+/* Where threads without a slot keep their counters */
+inline tm_thread_stats& tm_stats_dummy()
+{
+	static tm_thread_stats dummy;
+	return dummy;
+}
+
+FORCE_INLINE uint64_t tm_stats_now()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+inline void tm_stats_unlink()
+{
+	char name[64];
+
+	if (tm_stats_seg())
+		tm_stats_seg()->live.store(0, std::memory_order_release);
+	snprintf(name, sizeof(name), STATS_NAME_FMT, (int)getpid());
+	shm_unlink(name);
+}
+
+/* Creates the segment; the process keeps running without it on failure */
+inline void tm_stats_init()
+{
+#if !defined(TM_NO_STATS)
+	char name[64];
+	int fd;
+	void *mem;
+
+	if (tm_stats_seg())
+		return;
+
+	snprintf(name, sizeof(name), STATS_NAME_FMT, (int)getpid());
+	fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+
+	if (ftruncate(fd, sizeof(tm_stats_segment)) != 0) {
+		close(fd);
+		shm_unlink(name);
+		return;
+	}
+
+	mem = mmap(NULL, sizeof(tm_stats_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		shm_unlink(name);
+		return;
+	}
+
+	tm_stats_segment *seg = (tm_stats_segment *)mem;
+	for (int i = 0; i < STATS_MAX_THREADS; i++)
+		seg->threads[i].id.store(-1, std::memory_order_relaxed);
+	seg->magic = STATS_MAGIC;
+	seg->version = STATS_VERSION;
+	seg->max_threads = STATS_MAX_THREADS;
+	seg->live.store(1, std::memory_order_release);
+
+	tm_stats_seg() = seg;
+	atexit(tm_stats_unlink);
+#endif
+}
+
+inline tm_thread_stats *tm_stats_register(int id)
+{
+	tm_stats_segment *seg = tm_stats_seg();
+
+	if (!seg)
+		return &tm_stats_dummy();
+
+	uint32_t slot = seg->nthreads.fetch_add(1, std::memory_order_relaxed);
+	if (slot >= STATS_MAX_THREADS)
+		return &tm_stats_dummy();
+
+	seg->threads[slot].id.store(id, std::memory_order_release);
+	return &seg->threads[slot];
+}
+
+/* Single writer per slot: a relaxed load and store, never an RMW */
+FORCE_INLINE void tm_stats_bump(std::atomic<uint64_t>& counter)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+FORCE_INLINE void tm_stats_abort(tm_thread_stats *s, int cause)
+{
+#if !defined(TM_NO_STATS)
+	tm_stats_bump(s->aborts[cause]);
+	tm_stats_bump(s->retries);
+#endif
+}
+
+FORCE_INLINE void tm_stats_lag(tm_thread_stats *s, uint64_t lag)
+{
+#if !defined(TM_NO_STATS)
+	s->ring_lag.store(lag, std::memory_order_relaxed);
+#endif
+}
+
+#if !defined(TM_NO_STATS)
+
+#define TM_STATS_BEGIN(tx)										\
+		(tx)->stats->retries.store(0, std::memory_order_relaxed);		\
+		(tx)->stats->tx_start_ns.store(tm_stats_now(), std::memory_order_relaxed);
+
+#define TM_STATS_END(tx)										\
+		(tx)->stats->commits.store((tx)->commits, std::memory_order_relaxed);	\
+		(tx)->stats->tx_start_ns.store(0, std::memory_order_relaxed);
+
+#else
+
+#define TM_STATS_BEGIN(tx)
+#define TM_STATS_END(tx)
+
+#endif
+
+#endif //TM_STATS_HPP
@@ -0,0 +1,16 @@
+#include "swiss_stm.hpp"
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+__thread Tx_Context* Self;
+
+std::atomic<uint64_t> commit_clock(0);
+std::atomic<uint64_t> greedy_clock(0);
+std::atomic<Tx_Context*> swiss_threads[SWISS_MAX_THREADS];
+
+lock_entry* lock_table;
@@ -0,0 +1,358 @@
+#ifndef SWISS_TM_HPP
+#define SWISS_TM_HPP 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <string.h>
+#include <atomic>
+#include "rand_r_32.h"
+#include "WriteSet.hpp"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+
+/**
+ *  SwissTM-style mixed conflict detection over the stripe lock table.
+ *
+ *  Every stripe has a write lock (lock_owner) and a version (version, odd
+ *  while a commit writes the stripe back). Write/write conflicts are
+ *  caught eagerly: the first write to a stripe takes its write lock, and
+ *  the new value goes to the redo log. Read/write conflicts are caught
+ *  lazily: a read returns the committed value even while another
+ *  transaction holds the write lock. It only records the version. A
+ *  newer version extends the snapshot when the read set is still valid,
+ *  and commit validates again.
+ *
+ *  The contention manager has two phases. A transaction with fewer than
+ *  SWISS_CM_WRITES writes is short: when it meets a locked stripe it
+ *  drops its own locks, waits for that stripe to be released and
+ *  restarts. Past that it draws a greedy timestamp, which it keeps
+ *  across retries. On a conflict the older timestamp wins: the younger
+ *  or short owner is asked to abort, and the winner waits for the lock.
+ *  Long transactions thus stop losing their work to short ones.
+ */
+
+#define TABLE_SIZE 1048576
+#define ACCESS_SIZE 102400
+#define SWISS_MAX_THREADS 512
+
+#define SWISS_CM_WRITES	10			/* writes before a tx counts as long */
+#define SWISS_NO_TS	UINT64_MAX		/* short: no greedy timestamp yet */
+#define SWISS_WAIT_NS	100000			/* a lock wait this long aborts us */
+
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#define CACHELINE_BYTES 64
+#define CFENCE __asm__ volatile ("":::"memory")
+
+/* how an abort gets back to the start; the libitm layer overrides it */
+#ifndef TM_RESTART
+#define TM_RESTART(tx)	longjmp((tx)->scope, 1)
+#endif
+
+using stm::WriteSetEntry;
+using stm::WriteSet;
+
+struct lock_entry {
+	std::atomic<uint64_t> lock_owner;	/* id + 1 of the writer, or 0 */
+	std::atomic<uint64_t> version;		/* timestamp << 1 | writing back */
+};
+
+extern lock_entry* lock_table;
+
+struct swiss_read
+{
+	uint32_t stripe;
+	uint64_t version;
+};
+
+struct Tx_Context {
+	int id;
+	jmp_buf scope;
+	uint64_t valid_ts;				/* snapshot the reads are valid at */
+	std::atomic<uint64_t> cm_ts;			/* greedy timestamp, SWISS_NO_TS if short */
+	std::atomic<uint64_t> attempt;			/* bumped per attempt */
+	std::atomic<uint64_t> kill;			/* attempt another tx asked to abort */
+	int reads_pos;
+	swiss_read reads[ACCESS_SIZE];
+	int writes_pos;
+	uint32_t writes[ACCESS_SIZE];			/* stripes we hold the write lock on */
+	uint64_t old_versions[ACCESS_SIZE];		/* versions before commit locked them */
+	WriteSet* writeset;
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
+	long commits =0, aborts =0;
+};
+
+extern __thread Tx_Context* Self;
+
+extern std::atomic<uint64_t> commit_clock;
+extern std::atomic<uint64_t> greedy_clock;
+extern std::atomic<Tx_Context*> swiss_threads[SWISS_MAX_THREADS];
+
+#define TM_TX_VAR	Tx_Context* tx = (Tx_Context*)Self;
+
+inline unsigned long long get_real_time() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
+	lock_table = (lock_entry*) malloc(sizeof(lock_entry) * TABLE_SIZE);
+
+	for (int i=0; i < TABLE_SIZE; i++) {
+		lock_table[i].lock_owner.store(0, std::memory_order_relaxed);
+		lock_table[i].version.store(0, std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+FORCE_INLINE uint32_t swiss_stripe(uint64_t *addr)
+{
+	return (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+}
+
+FORCE_INLINE void swiss_release(Tx_Context* tx)
+{
+	for (int i = 0; i < tx->writes_pos; i++)
+		lock_table[tx->writes[i]].lock_owner.store(0, std::memory_order_release);
+	tx->writes_pos = 0;
+}
+
+inline void swiss_abort(Tx_Context* tx, int cause)
+{
+	swiss_release(tx);
+	tx->aborts++;
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
+	TM_RESTART(tx);
+}
+
+/* Another transaction won a conflict against this attempt */
+FORCE_INLINE void swiss_check_kill(Tx_Context* tx)
+{
+	if (__builtin_expect(tx->kill.load(std::memory_order_relaxed) ==
+			tx->attempt.load(std::memory_order_relaxed), false))
+		swiss_abort(tx, ABORT_CONFLICT);
+}
+
+/* Every read still has the version it was read at */
+inline bool swiss_validate(Tx_Context* tx)
+{
+	uint64_t self = tx->id + 1;
+
+	for (int i = 0; i < tx->reads_pos; i++) {
+		lock_entry* entry_p = &lock_table[tx->reads[i].stripe];
+		uint64_t version = entry_p->version.load(std::memory_order_acquire);
+		if (version == tx->reads[i].version)
+			continue;
+		/* our own commit is writing it back */
+		if (version != (tx->reads[i].version | 1) ||
+				entry_p->lock_owner.load(std::memory_order_relaxed) != self)
+			return false;
+	}
+	return true;
+}
+
+/* Moves the snapshot forward if nothing we read has changed */
+inline void swiss_extend(Tx_Context* tx)
+{
+	uint64_t now = commit_clock.load(std::memory_order_acquire);
+
+	if (!swiss_validate(tx))
+		swiss_abort(tx, ABORT_CONFLICT);
+	tx->valid_ts = now;
+}
+
+FORCE_INLINE uint64_t swiss_read_word(uint64_t* addr, Tx_Context* tx)
+{
+	uint32_t stripe = swiss_stripe(addr);
+	lock_entry* entry_p = &lock_table[stripe];
+
+	if (entry_p->lock_owner.load(std::memory_order_relaxed) == (uint64_t)(tx->id + 1)) {
+		WriteSetEntry log((void**)addr);
+		if (tx->writeset->find(log))
+			return log.val;
+	}
+
+	swiss_check_kill(tx);
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	for (;;) {
+		uint64_t v1 = entry_p->version.load(std::memory_order_acquire);
+		if (v1 & 1) {				/* being written back */
+			tm_poll(&p);
+			continue;
+		}
+		uint64_t val = *addr;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (entry_p->version.load(std::memory_order_relaxed) != v1)
+			continue;
+		if ((v1 >> 1) > tx->valid_ts)
+			swiss_extend(tx);
+
+		tx->reads[tx->reads_pos].stripe = stripe;
+		tx->reads[tx->reads_pos].version = v1;
+		tx->reads_pos++;
+		TM_PROF_READ(tx)
+		return val;
+	}
+}
+
+/* Polls until the stripe's owner changes; false once SWISS_WAIT_NS passed */
+inline bool swiss_wait_owner(Tx_Context* tx, lock_entry* entry_p, uint64_t owner, bool killable)
+{
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	while (entry_p->lock_owner.load(std::memory_order_acquire) == owner) {
+		if (killable)
+			swiss_check_kill(tx);
+		if (!tm_poll_timed(&p, SWISS_WAIT_NS))
+			return false;
+	}
+	return true;
+}
+
+/* The lock holder of a stripe we want; decides who gives way */
+inline void swiss_contend(Tx_Context* tx, lock_entry* entry_p, uint64_t owner)
+{
+	Tx_Context* other = swiss_threads[owner - 1].load(std::memory_order_acquire);
+	uint64_t attempt = other->attempt.load(std::memory_order_acquire);
+
+	uint64_t mine = tx->cm_ts.load(std::memory_order_relaxed);
+
+	if (mine == SWISS_NO_TS || other->cm_ts.load(std::memory_order_relaxed) < mine) {
+		/* we give way: drop our locks, let the owner finish, then retry */
+		swiss_release(tx);
+		swiss_wait_owner(tx, entry_p, owner, false);
+		swiss_abort(tx, ABORT_LOCKED);
+	}
+
+	/* it aborts at its next access, or commits */
+	other->kill.store(attempt, std::memory_order_release);
+	if (!swiss_wait_owner(tx, entry_p, owner, true))
+		swiss_abort(tx, ABORT_LOCKED);
+}
+
+FORCE_INLINE void swiss_write_word(uint64_t* addr, uint64_t val, Tx_Context* tx)
+{
+	uint32_t stripe = swiss_stripe(addr);
+	lock_entry* entry_p = &lock_table[stripe];
+	uint64_t self = tx->id + 1;
+
+	swiss_check_kill(tx);
+	for (uint64_t owner = entry_p->lock_owner.load(std::memory_order_relaxed); owner != self;
+			owner = entry_p->lock_owner.load(std::memory_order_relaxed)) {
+		if (owner) {
+			swiss_contend(tx, entry_p, owner);
+			continue;
+		}
+		if (entry_p->lock_owner.compare_exchange_strong(owner, self,
+				std::memory_order_acquire, std::memory_order_relaxed)) {
+			tx->writes[tx->writes_pos++] = stripe;
+			if (tx->writes_pos == SWISS_CM_WRITES &&
+					tx->cm_ts.load(std::memory_order_relaxed) == SWISS_NO_TS)
+				tx->cm_ts.store(greedy_clock.fetch_add(1, std::memory_order_relaxed),
+						std::memory_order_relaxed);
+			break;
+		}
+	}
+	tx->writeset->insert(WriteSetEntry((void**)addr, val));
+}
+
+#define TM_READ(var)       swiss_read_word(&var, tx)
+#define TM_WRITE(var, val) swiss_write_word(&var, val, tx)
+
+FORCE_INLINE void thread_init(int id) {
+	if (!Self) {
+		Self = new Tx_Context();
+		Tx_Context* tx = (Tx_Context*)Self;
+		tx->id = id;
+		tx->cm_ts.store(SWISS_NO_TS, std::memory_order_relaxed);
+		tx->attempt.store(1, std::memory_order_relaxed);
+		tx->kill.store(0, std::memory_order_relaxed);
+		tx->writes_pos = 0;
+		tx->writeset = new WriteSet(ACCESS_SIZE);
+		tx->stats = tm_stats_register(id);
+		swiss_threads[id].store(tx, std::memory_order_release);
+	}
+}
+
+FORCE_INLINE void swiss_commit(Tx_Context* tx)
+{
+	if (tx->writes_pos == 0) {		/* read-only: valid at valid_ts */
+		tx->cm_ts.store(SWISS_NO_TS, std::memory_order_relaxed);
+		tx->commits++;
+		return;
+	}
+
+	/* past this point nobody can make us abort but our own validation */
+	swiss_check_kill(tx);
+	tx->attempt.fetch_add(1, std::memory_order_acq_rel);
+
+	for (int i = 0; i < tx->writes_pos; i++) {
+		lock_entry* entry_p = &lock_table[tx->writes[i]];
+		tx->old_versions[i] = entry_p->version.load(std::memory_order_relaxed);
+		entry_p->version.store(tx->old_versions[i] | 1, std::memory_order_relaxed);
+	}
+	/* the RMW orders the locked versions before our validation reads */
+	uint64_t ts = commit_clock.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+	if (ts > tx->valid_ts + 1 && !swiss_validate(tx)) {
+		for (int i = 0; i < tx->writes_pos; i++)
+			lock_table[tx->writes[i]].version.store(tx->old_versions[i],
+					std::memory_order_release);
+		swiss_abort(tx, ABORT_CONFLICT);
+	}
+
+	tx->writeset->writeback();
+	std::atomic_thread_fence(std::memory_order_release);
+	for (int i = 0; i < tx->writes_pos; i++)
+		lock_table[tx->writes[i]].version.store(ts << 1, std::memory_order_release);
+	swiss_release(tx);
+	tx->cm_ts.store(SWISS_NO_TS, std::memory_order_relaxed);
+	tx->commits++;
+}
+
+FORCE_INLINE void swiss_begin(Tx_Context* tx)
+{
+	tx->attempt.fetch_add(1, std::memory_order_acq_rel);
+	tx->reads_pos = 0;
+	tx->writes_pos = 0;
+	tx->writeset->reset();
+	tx->valid_ts = commit_clock.load(std::memory_order_acquire);
+}
+
+#define TM_BEGIN												\
+	{															\
+		Tx_Context* tx = (Tx_Context*)Self;          			\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
+		{														\
+			TM_PROF_ATTEMPT(tx)									\
+			swiss_begin(tx);
+
+
+#define TM_END                                  	\
+			swiss_commit(tx);                          \
+			TM_LEAVE(tx)                          \
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->writeset->size())	\
+		}								\
+	}
+
+#endif //SWISS_TM_HPP
@@ -0,0 +1,38 @@
+#ifndef TM_SELECT_HPP
+#define TM_SELECT_HPP 1
+
+/**
+ *  Picks the engine a driver is compiled against. All engines export the
+ *  same TM_BEGIN / TM_READ / TM_WRITE / TM_END interface.
+ *
+ *    -DRING_PARTITIONED   partitioned RingSTM (ring_part_stm.hpp)
+ *    -DTM_TL2             TL2 over the lock table (tm_thread.hpp)
+ *    -DTM_TML             one global sequence lock (tml_stm.hpp)
+ *    -DTM_2PL             strict two-phase locking (tpl_stm.hpp)
+ *    -DTM_SWISS           eager write/write, lazy read/write (swiss_stm.hpp)
+ *    default              RingSTM (ring_stm.hpp)
+ *
+ *  TM_ENGINE_NAME names the choice in result records.
+ */
+
+#if defined(RING_PARTITIONED)
+#include "ring_part_stm.hpp"
+#define TM_ENGINE_NAME "part"
+#elif defined(TM_TL2)
+#include "tm_thread.hpp"
+#define TM_ENGINE_NAME "tl2"
+#elif defined(TM_TML)
+#include "tml_stm.hpp"
+#define TM_ENGINE_NAME "tml"
+#elif defined(TM_2PL)
+#include "tpl_stm.hpp"
+#define TM_ENGINE_NAME "2pl"
+#elif defined(TM_SWISS)
+#include "swiss_stm.hpp"
+#define TM_ENGINE_NAME "swiss"
+#else
+#include "ring_stm.hpp"
+#define TM_ENGINE_NAME "ring"
+#endif
+
+#endif //TM_SELECT_HPP
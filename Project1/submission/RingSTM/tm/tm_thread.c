@@ -12,7 +12,7 @@
 
 __thread Tx_Context* Self;
 
-pad_word_t global_clock = {0};
+pad_word_t global_clock;
 
 lock_entry* lock_table;
 
@@ -16,36 +16,42 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <atomic>
 #include "rand_r_32.h"
 #include "WriteSet.hpp"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
 
 #define TABLE_SIZE 1048576
 
 #define FORCE_INLINE __attribute__((always_inline)) inline
 #define CACHELINE_BYTES 64
 #define CFENCE              __asm__ volatile ("":::"memory")
-#define MFENCE  __asm__ volatile ("mfence":::"memory")
+
+/* how an abort gets back to the start; the libitm layer overrides it */
+#ifndef TM_RESTART
+#define TM_RESTART(tx)	longjmp((tx)->scope, 1)
+#endif
 
 using stm::WriteSetEntry;
 using stm::WriteSet;
 
 struct pad_word_t
   {
-      volatile uintptr_t val;
+      std::atomic<uintptr_t> val;
       char pad[CACHELINE_BYTES-sizeof(uintptr_t)];
   };
 
 struct lock_entry {
-	volatile uint64_t lock_owner;
-	volatile uint64_t version;
+	std::atomic<uint64_t> lock_owner;
+	std::atomic<uint64_t> version;
 };
 
 
 extern lock_entry* lock_table;
 
-#define nop()       __asm__ volatile("nop")
-#define pause()		__asm__ ( "pause;" )
-
 #define NUM_STRIPES  1048576
 
 
@@ -58,6 +64,7 @@ inline unsigned long long get_real_time() {
 }
 
 #define ACCESS_SIZE 102400
+#define ELASTIC_WINDOW 4		/* reads an elastic search keeps, see elastic.hpp */
 
 struct Tx_Context {
 	int id;
@@ -70,6 +77,15 @@ struct Tx_Context {
 	uint64_t writes[ACCESS_SIZE];
 	bool granted_writes[ACCESS_SIZE];
 	WriteSet* writeset;
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
+	bool declared = false;				/* running a declared tx, see declared.hpp */
+	bool elastic = false;				/* still searching, see elastic.hpp */
+	bool si = false;				/* snapshot isolation, see TM_SI */
+	int window_pos;
+	uintptr_t window_time;				/* clock when the window was last checked */
+	uint64_t window_index[ELASTIC_WINDOW];		/* the last reads, a ring */
+	uint64_t window_version[ELASTIC_WINDOW];
 	long commits =0, aborts =0;
 };
 
@@ -88,10 +104,19 @@ extern pad_word_t global_clock;
 
 #define TM_ALLOC(a) malloc(a)
 
-FORCE_INLINE void tm_abort(Tx_Context* tx, int explicitly);
+FORCE_INLINE void tm_abort(Tx_Context* tx, int cause);
+FORCE_INLINE uint64_t tm_declared_read(uint64_t* addr, Tx_Context* tx);
+FORCE_INLINE void tm_declared_write(uint64_t* addr, uint64_t val, Tx_Context* tx);
+FORCE_INLINE uint64_t tm_elastic_read(uint64_t* addr, Tx_Context* tx);
+inline void tm_elastic_settle(Tx_Context* tx);
 
 FORCE_INLINE uint64_t tm_read(uint64_t* addr, Tx_Context* tx)
 {
+	if (__builtin_expect(tx->declared, false))
+		return tm_declared_read(addr, tx);
+	if (__builtin_expect(tx->elastic, false))
+		return tm_elastic_read(addr, tx);
+
     WriteSetEntry log((void**)addr);
     bool found = tx->writeset->find(log);
     if (__builtin_expect(found, false))
@@ -101,21 +126,38 @@ FORCE_INLINE uint64_t tm_read(uint64_t* addr, Tx_Context* tx)
 	uint64_t index = (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
 	lock_entry* entry_p = &(lock_table[index]);
 
-	uint64_t v1 = entry_p->version;
-	CFENCE;
+	uint64_t v1 = entry_p->version.load(std::memory_order_acquire);
 	uint64_t val = *addr;
-	CFENCE;
-	uint64_t v2 = entry_p->version;
-	if (v1 > tx->start_time || (v1 != v2) || entry_p->lock_owner) {
-		tm_abort(tx, 0);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t v2 = entry_p->version.load(std::memory_order_relaxed);
+	if (v1 > tx->start_time || (v1 != v2) ||
+			entry_p->lock_owner.load(std::memory_order_relaxed)) {
+		/* let the committing owner finish before we retry */
+		tm_waiter w;
+		uint64_t owner;
+
+		int cause = ABORT_CONFLICT;
+
+		tm_wait_reset(&w);
+		while ((owner = entry_p->lock_owner.load(std::memory_order_relaxed)) != 0) {
+			tm_wait(&w, &entry_p->lock_owner, (uint32_t)owner);
+			cause = ABORT_LOCKED;
+		}
+		tm_abort(tx, cause);
 	}
 	int r_pos = tx->reads_pos++;
 	tx->reads[r_pos] = index;
+	TM_PROF_READ(tx)
 	return val;
 }
 
 FORCE_INLINE void tm_write(uint64_t* addr, uint64_t val, Tx_Context* tx)
 {
+	if (__builtin_expect(tx->declared, false))
+		return tm_declared_write(addr, val, tx);
+	if (__builtin_expect(tx->elastic, false))
+		tm_elastic_settle(tx);
+
     bool alreadyExists = tx->writeset->insert(WriteSetEntry((void**)addr, *((uint64_t*)(&val))));
     if (!alreadyExists) {
 		int w_pos = tx->writes_pos++;
@@ -128,35 +170,45 @@ FORCE_INLINE void tm_write(uint64_t* addr, uint64_t val, Tx_Context* tx)
 #define TM_WRITE(var, val) tm_write(&var, val, tx)
 
 
-FORCE_INLINE void spin64() {
-	for (int i = 0; i < 64; i++)
-		nop();
-}
-
 FORCE_INLINE void thread_init(int id) {
 	if (!Self) {
 		Self = new Tx_Context();
 		Tx_Context* tx = (Tx_Context*)Self;
 		tx->id = id;
 		tx->writeset = new WriteSet(ACCESS_SIZE);
+		tx->stats = tm_stats_register(id);
 	}
 }
 
 FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
 	lock_table = (lock_entry*) malloc(sizeof(lock_entry) * TABLE_SIZE);
 
 	for (int i=0; i < TABLE_SIZE; i++) {
-		lock_table[i].lock_owner = 0;
-		lock_table[i].version = 0;
+		lock_table[i].lock_owner.store(0, std::memory_order_relaxed);
+		lock_table[i].version.store(0, std::memory_order_relaxed);
 	}
+	std::atomic_thread_fence(std::memory_order_release);
 }
 
 
-FORCE_INLINE void tm_abort(Tx_Context* tx, int explicitly)
+FORCE_INLINE void tm_abort(Tx_Context* tx, int cause)
 {
 	tx->aborts++;
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
 	//restart the tx
-    longjmp(tx->scope, 1);
+	TM_RESTART(tx);
+}
+
+/* Under SI a written stripe must not have changed since the start:
+ * the first committer wins */
+FORCE_INLINE bool tm_si_valid(Tx_Context* tx)
+{
+	for (int i = 0; i < tx->writes_pos; i++)
+		if (lock_table[tx->writes[i]].version.load(std::memory_order_acquire) > tx->start_time)
+			return false;
+	return true;
 }
 
 FORCE_INLINE void tm_commit(Tx_Context* tx)
@@ -168,8 +220,10 @@ FORCE_INLINE void tm_commit(Tx_Context* tx)
 	bool failed = false;
 	for (int i = 0; i < tx->writes_pos; i++) {
 		lock_entry* entry_p = &(lock_table[tx->writes[i]]);
-		if (entry_p->lock_owner == (tx->id + 1)) continue;
-		if (!__sync_bool_compare_and_swap(&(entry_p->lock_owner), 0, tx->id+1)) {
+		uint64_t unlocked = 0;
+		if (entry_p->lock_owner.load(std::memory_order_relaxed) == (uint64_t)(tx->id + 1)) continue;
+		if (!entry_p->lock_owner.compare_exchange_strong(unlocked, tx->id + 1,
+				std::memory_order_acquire, std::memory_order_relaxed)) {
 			failed = true;
 			break;
 		}
@@ -179,62 +233,99 @@ FORCE_INLINE void tm_commit(Tx_Context* tx)
 		for (int i = 0; i < tx->writes_pos; i++) {
 			if (tx->granted_writes[i]) {
 				lock_entry* entry_p = &(lock_table[tx->writes[i]]);
-				entry_p->lock_owner = 0;
-			} else {
-				break;
+				entry_p->lock_owner.store(0, std::memory_order_release);
+				tm_wake(&entry_p->lock_owner);
 			}
 		}
 
-		tm_abort(tx, 0);
+		tm_abort(tx, ABORT_LOCKED);
 	}
 
  	bool do_abort = false;
-	//validate reads
-	for (int i = 0; i < tx->reads_pos; i++) {
-		lock_entry* entry_p = &(lock_table[tx->reads[i]]);
-		if (entry_p->version > tx->start_time || (entry_p->lock_owner > 0 && entry_p->lock_owner != tx->id + 1)) {
-			do_abort = true;
-			break;
+	tm_stats_lag(tx->stats, global_clock.val.load(std::memory_order_relaxed) - tx->start_time);
+	//validate reads, or only writes under SI
+	if (__builtin_expect(tx->si, false)) {
+		do_abort = !tm_si_valid(tx);
+	} else {
+		for (int i = 0; i < tx->reads_pos; i++) {
+			lock_entry* entry_p = &(lock_table[tx->reads[i]]);
+			uint64_t owner = entry_p->lock_owner.load(std::memory_order_acquire);
+			if (entry_p->version.load(std::memory_order_acquire) > tx->start_time ||
+					(owner > 0 && owner != (uint64_t)(tx->id + 1))) {
+				do_abort = true;
+				break;
+			}
 		}
 	}
 
 	if (do_abort) {
 		for (int i = 0; i < tx->writes_pos; i++) {
 			lock_entry* entry_p = &(lock_table[tx->writes[i]]);
-			entry_p->lock_owner = 0;
+			entry_p->lock_owner.store(0, std::memory_order_release);
+			tm_wake(&entry_p->lock_owner);
 		}
-		tm_abort(tx, 0);
+		tm_abort(tx, ABORT_CONFLICT);
 	}
 
+	/* the lock CASes only acquire; keep the write-back behind them */
+	std::atomic_thread_fence(std::memory_order_release);
 	tx->writeset->writeback();
-	MFENCE;
 
-	uintptr_t next_ts = __sync_fetch_and_add(&(global_clock.val), 1) + 1;
+	/* the RMW orders the write-back before the new versions */
+	uintptr_t next_ts = global_clock.val.fetch_add(1, std::memory_order_acq_rel) + 1;
 
 	//update versions & unlock
 	for (int i = 0; i < tx->writes_pos; i++) {
 		lock_entry* entry_p = &(lock_table[tx->writes[i]]);
-		entry_p->version = next_ts;
-		entry_p->lock_owner = 0;
+		entry_p->version.store(next_ts, std::memory_order_relaxed);
+		entry_p->lock_owner.store(0, std::memory_order_release);
+		tm_wake(&entry_p->lock_owner);
 	}
 	tx->commits++;
 }
 
+FORCE_INLINE void tm_begin(Tx_Context* tx)
+{
+	tx->reads_pos = 0;
+	tx->writes_pos = 0;
+	tx->granted_writes_pos = 0;
+	tx->elastic = false;
+	tx->si = false;
+	tx->writeset->reset();
+	tx->start_time = global_clock.val.load(std::memory_order_acquire);
+}
+
 #define TM_BEGIN												\
 	{															\
 		Tx_Context* tx = (Tx_Context*)Self;          			\
-		uint32_t abort_flags = _setjmp (tx->scope);				\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
 		{														\
-			tx->reads_pos =0;									\
-			tx->writes_pos =0;									\
-			tx->granted_writes_pos =0;							\
-			tx->writeset->reset();								\
-			tx->start_time = global_clock.val;
+			TM_PROF_ATTEMPT(tx)									\
+			tm_begin(tx);
 
 
+/**
+ *  TM_SI, right after TM_BEGIN, runs the transaction under snapshot
+ *  isolation. Reads still come from the snapshot at the start, but commit
+ *  no longer validates them. It only checks that no stripe we write was
+ *  committed to since the start. Write skew becomes possible, so this is
+ *  for transactions that opt in, such as reports that read much and
+ *  write little.
+ */
+#define TM_SI	tx->si = true;
+
 #define TM_END                                  	\
 			tm_commit(tx);                          \
-		}											\
+			TM_LEAVE(tx)                          \
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->writeset->size())	\
+		}								\
 	}
 
+#include "declared.hpp"
+#include "elastic.hpp"
+
 #endif //TM_HPP
@@ -0,0 +1,13 @@
+#include "tml_stm.hpp"
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+__thread Tx_Context* Self;
+
+
+std::atomic<uint64_t> tml_seq(0);
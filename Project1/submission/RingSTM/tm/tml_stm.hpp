@@ -0,0 +1,168 @@
+#ifndef TML_TM_HPP
+#define TML_TM_HPP 1
+
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <sys/types.h>
+#include <string.h>
+#include <atomic>
+#include "rand_r_32.h"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+
+/**
+ *  Transactional Mutex Lock: one global sequence lock and nothing else.
+ *
+ *  A transaction starts from an even sequence number. Reads go straight
+ *  to memory and only check that the sequence has not moved, so there
+ *  is no read set, filter or write set. The first write takes the lock
+ *  by moving the sequence from the start value to odd. From then on the
+ *  transaction is irrevocable and writes in place. Commit makes the
+ *  sequence even again. Any writer commit aborts every reader that is
+ *  running, so this pays off only when writes are rare.
+ */
+
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#define CACHELINE_BYTES 64
+#define CFENCE __asm__ volatile ("":::"memory")
+
+/* how an abort gets back to the start; the libitm layer overrides it */
+#ifndef TM_RESTART
+#define TM_RESTART(tx)	longjmp((tx)->scope, 1)
+#endif
+
+struct Tx_Context
+{
+	int id;
+	jmp_buf scope;
+	uint64_t start;					/* sequence we started from */
+	bool writer;					/* holds the sequence lock */
+	long writes;					/* in this attempt, for the profile */
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
+	long commits =0, aborts =0;
+};
+
+extern __thread Tx_Context* Self;
+
+extern std::atomic<uint64_t> tml_seq;		/* odd while a writer runs */
+
+
+#define TM_TX_VAR Tx_Context* tx = (Tx_Context*)Self;
+
+inline unsigned long long get_real_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
+	tml_seq.store(0, std::memory_order_release);
+}
+
+FORCE_INLINE void tml_tm_abort(Tx_Context *tx, int cause)
+{
+	tx->aborts++;
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
+	TM_RESTART(tx);
+}
+
+FORCE_INLINE uint64_t tml_tm_read(uint64_t *addr, Tx_Context *tx)
+{
+	uint64_t val = *addr;
+
+	if (tx->writer)
+		return val;
+
+	TM_PROF_READ(tx)
+	/* the value must be read before the sequence is checked */
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (tml_seq.load(std::memory_order_relaxed) != tx->start)
+		tml_tm_abort(tx, ABORT_CONFLICT);
+	return val;
+}
+
+FORCE_INLINE void tml_tm_write(uint64_t *addr, uint64_t val, Tx_Context *tx)
+{
+	if (!tx->writer) {
+		uint64_t expected = tx->start;
+
+		if (!tml_seq.compare_exchange_strong(expected, tx->start + 1,
+				std::memory_order_acq_rel, std::memory_order_relaxed))
+			tml_tm_abort(tx, ABORT_CONFLICT);
+		/* seqlock writer: the odd sequence is seen before our stores */
+		std::atomic_thread_fence(std::memory_order_release);
+		tx->writer = true;
+	}
+	*addr = val;
+	tx->writes++;
+}
+
+#define TM_READ(var)	tml_tm_read(&var, tx)
+#define TM_WRITE(var, val) tml_tm_write(&var, val, tx)
+
+FORCE_INLINE void tml_tm_commit(Tx_Context *tx)
+{
+	if (tx->writer) {
+		tml_seq.store(tx->start + 2, std::memory_order_release);
+		tm_wake(&tml_seq);
+		tx->writer = false;
+	}
+	tx->commits++;
+}
+
+FORCE_INLINE void thread_init(int id)
+{
+	if (!Self)
+	{
+		Self = new Tx_Context();
+		Tx_Context *tx = (Tx_Context *)Self;
+		tx->id = id;
+		tx->writer = false;
+		tx->stats = tm_stats_register(id);
+	}
+}
+
+/* Starts an attempt once no writer holds the lock */
+FORCE_INLINE void tml_tm_begin(Tx_Context *tx)
+{
+	uint64_t seq;
+	tm_waiter w;
+
+	tm_wait_reset(&w);
+	while ((seq = tml_seq.load(std::memory_order_acquire)) & 1)
+		tm_wait(&w, &tml_seq, (uint32_t)seq);
+	tx->start = seq;
+	tx->writes = 0;
+}
+
+#define TM_BEGIN												\
+	{															\
+		Tx_Context *tx = (Tx_Context *)Self;					\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
+		{														\
+			TM_PROF_ATTEMPT(tx)									\
+			tml_tm_begin(tx);
+
+#define TM_END							\
+			tml_tm_commit(tx);			\
+			TM_LEAVE(tx)			\
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->writes)	\
+		}								\
+	}
+
+#endif //TML_TM_HPP
@@ -0,0 +1,13 @@
+#include "tpl_stm.hpp"
+#include <pthread.h>
+#include <signal.h>
+
+#include <stdio.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+__thread Tx_Context* Self;
+
+
+lock_entry* lock_table;
@@ -0,0 +1,292 @@
+#ifndef TPL_TM_HPP
+#define TPL_TM_HPP 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <string.h>
+#include <atomic>
+#include "rand_r_32.h"
+#include "BitFilter.h"
+#include "wait.hpp"
+#include "admission.hpp"
+#include "stats.hpp"
+#include "profile.hpp"
+
+/**
+ *  Strict two-phase locking over the stripe lock table, the pessimistic
+ *  baseline next to the optimistic engines.
+ *
+ *  Every stripe has a reader/writer lock word: a writer's id + 1 in bits
+ *  16-31, or a count of readers in bits 0-15. A read takes the
+ *  stripe shared, a write takes it exclusive (upgrading a shared lock we
+ *  are the only reader of) and then updates memory in place, keeping the
+ *  old value in an undo log. Locks are only dropped at commit or abort.
+ *
+ *  A transaction that cannot get a lock waits instead of aborting. It
+ *  polls briefly and then yields (tm_poll_timed()) rather than going
+ *  through tm_wait():
+ *  the lock holder is usually runnable and needs the cpu, so backing off
+ *  in place would only stretch the wait. A wait that lasts TPL_TIMEOUT_NS
+ *  is taken as a deadlock: the waiter rolls its writes back, drops its
+ *  locks, yields a random number of times and retries. Two readers that
+ *  both upgrade would always deadlock, so an upgrade that finds another
+ *  reader aborts at once instead of waiting. Timeouts stand in for a
+ *  wait-for graph because readers are only counted, so a waiter cannot
+ *  tell whom it waits for.
+ */
+
+#define TABLE_SIZE 1048576
+#define ACCESS_SIZE 102400
+
+#ifndef TPL_TIMEOUT_NS
+#define TPL_TIMEOUT_NS	100000			/* a wait this long is a deadlock */
+#endif
+
+#define TPL_WRITER_SHIFT	16
+
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#define CACHELINE_BYTES 64
+#define CFENCE __asm__ volatile ("":::"memory")
+
+/* how an abort gets back to the start; the libitm layer overrides it */
+#ifndef TM_RESTART
+#define TM_RESTART(tx)	longjmp((tx)->scope, 1)
+#endif
+
+struct lock_entry {
+	std::atomic<uint64_t> state;		/* writer id + 1 << 16 | readers */
+};
+
+extern lock_entry* lock_table;
+
+struct tpl_undo
+{
+	uint64_t *addr;
+	uint64_t val;				/* value before our first write */
+};
+
+struct tpl_held
+{
+	uint32_t stripe;
+	bool write;
+};
+
+struct Tx_Context
+{
+	int id;
+	jmp_buf scope;
+	int held_pos;
+	tpl_held held[ACCESS_SIZE];		/* locks in acquisition order */
+	BitFilter<4096> held_filter;		/* stripes we may hold */
+	int undo_pos;
+	tpl_undo undo[ACCESS_SIZE];
+	unsigned int seed;			/* for the backoff */
+	int backoff;				/* current backoff, 0 after commit */
+	tm_thread_stats *stats;				/* live counters, see stats.hpp */
+	tm_prof_tx prof;				/* call-site profile, see profile.hpp */
+	long commits =0, aborts =0;
+};
+
+extern __thread Tx_Context* Self;
+
+
+#define TM_TX_VAR Tx_Context* tx = (Tx_Context*)Self;
+
+inline unsigned long long get_real_time()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+FORCE_INLINE void tm_sys_init() {
+	tm_stats_init();
+	lock_table = (lock_entry*) malloc(sizeof(lock_entry) * TABLE_SIZE);
+	for (int i=0; i < TABLE_SIZE; i++)
+		lock_table[i].state.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+FORCE_INLINE uint32_t tpl_stripe(uint64_t *addr)
+{
+	return (reinterpret_cast<uint64_t>(addr)>>3) % TABLE_SIZE;
+}
+
+/* Drops every lock, readers by count and writers outright */
+FORCE_INLINE void tpl_release(Tx_Context *tx)
+{
+	for (int i = tx->held_pos - 1; i >= 0; i--) {
+		lock_entry *entry_p = &lock_table[tx->held[i].stripe];
+		if (tx->held[i].write)
+			entry_p->state.store(0, std::memory_order_release);
+		else
+			entry_p->state.fetch_sub(1, std::memory_order_release);
+	}
+	tx->held_pos = 0;
+}
+
+inline void tpl_abort(Tx_Context *tx, int cause)
+{
+	for (int i = tx->undo_pos - 1; i >= 0; i--)
+		*tx->undo[i].addr = tx->undo[i].val;
+	tpl_release(tx);
+
+	tx->aborts++;
+	tm_stats_abort(tx->stats, cause);
+	tm_prof_abort(&tx->prof, cause);
+
+	tm_backoff(&tx->backoff, &tx->seed);
+	TM_RESTART(tx);
+}
+
+/* Index of our entry for stripe in held[], or -1 */
+FORCE_INLINE int tpl_find(Tx_Context *tx, uint32_t stripe)
+{
+	if (!tx->held_filter.lookup((void *)((uintptr_t)stripe << 3)))
+		return -1;
+	for (int i = tx->held_pos - 1; i >= 0; i--)
+		if (tx->held[i].stripe == stripe)
+			return i;
+	return -1;
+}
+
+enum tpl_mode { TPL_SHARED, TPL_EXCLUSIVE, TPL_UPGRADE };
+
+/* Takes the stripe in mode, waiting up to TPL_TIMEOUT_NS */
+FORCE_INLINE void tpl_acquire(Tx_Context *tx, lock_entry *entry_p, int mode)
+{
+	uint64_t self = (uint64_t)(tx->id + 1) << TPL_WRITER_SHIFT;
+	uint64_t state = entry_p->state.load(std::memory_order_relaxed);
+	tm_poller p;
+
+	tm_poll_reset(&p);
+	for (;;) {
+		bool free;
+		uint64_t desired;
+
+		switch (mode) {
+		case TPL_SHARED:
+			free = (state >> TPL_WRITER_SHIFT) == 0;
+			desired = state + 1;
+			break;
+		case TPL_EXCLUSIVE:
+			free = state == 0;
+			desired = self;
+			break;
+		default:		/* we are the only reader left */
+			if (state != 1)
+				tpl_abort(tx, ABORT_LOCKED);
+			free = true;
+			desired = self;
+			break;
+		}
+		if (free) {
+			if (entry_p->state.compare_exchange_weak(state, desired,
+					std::memory_order_acquire, std::memory_order_relaxed))
+				return;
+			continue;
+		}
+		if (!tm_poll_timed(&p, TPL_TIMEOUT_NS))
+			tpl_abort(tx, ABORT_LOCKED);
+		state = entry_p->state.load(std::memory_order_relaxed);
+	}
+}
+
+FORCE_INLINE void tpl_hold(Tx_Context *tx, uint32_t stripe, bool write)
+{
+	tx->held[tx->held_pos].stripe = stripe;
+	tx->held[tx->held_pos].write = write;
+	tx->held_pos++;
+	tx->held_filter.add((void *)((uintptr_t)stripe << 3));
+}
+
+FORCE_INLINE uint64_t tpl_read(uint64_t *addr, Tx_Context *tx)
+{
+	uint32_t stripe = tpl_stripe(addr);
+
+	if (tpl_find(tx, stripe) < 0) {
+		tpl_acquire(tx, &lock_table[stripe], TPL_SHARED);
+		tpl_hold(tx, stripe, false);
+	}
+	TM_PROF_READ(tx)
+	return *addr;
+}
+
+FORCE_INLINE void tpl_write(uint64_t *addr, uint64_t val, Tx_Context *tx)
+{
+	uint32_t stripe = tpl_stripe(addr);
+	int i = tpl_find(tx, stripe);
+
+	if (i < 0) {
+		tpl_acquire(tx, &lock_table[stripe], TPL_EXCLUSIVE);
+		tpl_hold(tx, stripe, true);
+	} else if (!tx->held[i].write) {
+		tpl_acquire(tx, &lock_table[stripe], TPL_UPGRADE);
+		tx->held[i].write = true;
+	}
+
+	tx->undo[tx->undo_pos].addr = addr;
+	tx->undo[tx->undo_pos].val = *addr;
+	tx->undo_pos++;
+	*addr = val;
+}
+
+#define TM_READ(var)	tpl_read(&var, tx)
+#define TM_WRITE(var, val) tpl_write(&var, val, tx)
+
+FORCE_INLINE void tpl_commit(Tx_Context *tx)
+{
+	tpl_release(tx);
+	tx->backoff = 0;
+	tx->commits++;
+}
+
+FORCE_INLINE void thread_init(int id)
+{
+	if (!Self)
+	{
+		Self = new Tx_Context();
+		Tx_Context *tx = (Tx_Context *)Self;
+		tx->id = id;
+		tx->seed = id + 1;
+		tx->backoff = 0;
+		tx->held_pos = 0;
+		tx->stats = tm_stats_register(id);
+	}
+}
+
+FORCE_INLINE void tpl_begin(Tx_Context *tx)
+{
+	tx->held_pos = 0;
+	tx->undo_pos = 0;
+	tx->held_filter.clear();
+}
+
+#define TM_BEGIN												\
+	{															\
+		Tx_Context *tx = (Tx_Context *)Self;					\
+		TM_ADMIT()										\
+		TM_STATS_BEGIN(tx)									\
+		TM_PROF_BEGIN(tx)									\
+		_setjmp(tx->scope);										\
+		{														\
+			TM_PROF_ATTEMPT(tx)									\
+			tpl_begin(tx);
+
+#define TM_END							\
+			tpl_commit(tx);			\
+			TM_LEAVE(tx)			\
+			TM_STATS_END(tx)	\
+			TM_PROF_COMMIT(tx, tx->undo_pos)	\
+		}								\
+	}
+
+#endif //TPL_TM_HPP
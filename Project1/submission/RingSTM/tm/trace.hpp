@@ -0,0 +1,116 @@
+#ifndef TM_TRACE_HPP
+#define TM_TRACE_HPP 1
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ *  Binary workload traces, so every engine replays the same operations.
+ *
+ *  A trace is a header followed by one stream of fixed-size records per
+ *  thread, stored back to back. Replay maps the file read-only and each
+ *  thread walks its own stream in place. Nothing is parsed or copied, and
+ *  the loop reads one 16-byte record where it used to call rand_r_32()
+ *  several times.
+ *
+ *  A run is still timed, so a thread that reaches the end of its stream
+ *  starts over from the first record. Two runs on the same trace do the
+ *  same operations in the same order per thread. Only the interleaving
+ *  between threads and how far each one gets depend on the engine.
+ */
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+#define TRACE_MAGIC	0x54524143	/* "TRAC" */
+#define TRACE_VERSION	1
+
+enum trace_op_type { TRACE_TRANSFER };
+
+struct trace_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t threads;
+	uint32_t accounts;			/* the table the trace was made for */
+	uint64_t ops;				/* records per thread */
+};
+
+struct trace_op
+{
+	uint32_t from;
+	uint32_t to;
+	uint32_t amount;
+	uint32_t op;				/* a trace_op_type */
+};
+
+struct trace_file
+{
+	const trace_header *header;
+	size_t bytes;
+};
+
+/* Opens a trace for writing; fills in the header once all streams are out */
+inline FILE *trace_create(const char *path, uint32_t threads, uint32_t accounts, uint64_t ops)
+{
+	FILE *f = fopen(path, "wb");
+	trace_header header = { TRACE_MAGIC, TRACE_VERSION, threads, accounts, ops };
+
+	if (f && fwrite(&header, sizeof(header), 1, f) != 1) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* Streams must be appended in thread order, ops records each */
+inline bool trace_append(FILE *f, const trace_op *ops, size_t n)
+{
+	return fwrite(ops, sizeof(trace_op), n, f) == n;
+}
+
+/* Maps a trace and checks it is complete; false on any mismatch */
+inline bool trace_open(const char *path, trace_file *trace)
+{
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(trace_header)) {
+		close(fd);
+		return false;
+	}
+
+	void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return false;
+
+	const trace_header *h = (const trace_header *)mem;
+	if (h->magic != TRACE_MAGIC || h->version != TRACE_VERSION || !h->ops ||
+			(size_t)st.st_size != sizeof(trace_header) +
+				(size_t)h->threads * h->ops * sizeof(trace_op)) {
+		munmap(mem, st.st_size);
+		return false;
+	}
+	madvise(mem, st.st_size, MADV_SEQUENTIAL);
+
+	trace->header = h;
+	trace->bytes = st.st_size;
+	return true;
+}
+
+/* The records of thread id, header->ops of them */
+FORCE_INLINE const trace_op *trace_stream(const trace_file *trace, int id)
+{
+	return (const trace_op *)(trace->header + 1) + (size_t)id * trace->header->ops;
+}
+
+#endif //TM_TRACE_HPP
@@ -0,0 +1,68 @@
+#ifndef TM_VERIFY_HPP
+#define TM_VERIFY_HPP 1
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/**
+ *  Parallel set-up and checking of the account arrays.
+ *
+ *  Every worker initializes its own slice before the run. The first
+ *  write places a page on the node of the thread that touches it, so the
+ *  slices stay local. After the run every worker checksums the same
+ *  slice. The loops are plain, with no volatile, so the compiler
+ *  vectorizes them.
+ *
+ *  alloc_accounts() maps the array lazily and asks for transparent huge
+ *  pages. Where the kernel grants them, 100M accounts take 400 page
+ *  faults instead of 200k, and those faults are most of the set-up cost.
+ */
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+/* Untouched until fill_slice(); never freed, like the arrays it replaces */
+inline uint64_t *alloc_accounts(long n)
+{
+	size_t bytes = sizeof(uint64_t) * n;
+	void *mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mem == MAP_FAILED)
+		return (uint64_t *)malloc(bytes);
+	madvise(mem, bytes, MADV_HUGEPAGE);
+	return (uint64_t *)mem;
+}
+
+/* [*lo, *hi) is thread id's share of n elements */
+FORCE_INLINE void thread_slice(int id, int threads, long n, long *lo, long *hi)
+{
+	long share = n / threads, extra = n % threads;
+
+	*lo = id * share + (id < extra ? id : extra);
+	*hi = *lo + share + (id < extra ? 1 : 0);
+}
+
+inline void fill_slice(uint64_t * __restrict a, long lo, long hi, uint64_t val)
+{
+	for (long i = lo; i < hi; i++)
+		a[i] = val;
+}
+
+/* Sum of a[lo, hi); *changed counts the elements that differ from expect */
+inline uint64_t sum_slice(const uint64_t * __restrict a, long lo, long hi,
+		uint64_t expect, long *changed)
+{
+	uint64_t sum = 0;
+	long diff = 0;
+
+	for (long i = lo; i < hi; i++) {
+		sum += a[i];
+		diff += a[i] != expect;
+	}
+	*changed = diff;
+	return sum;
+}
+
+#endif //TM_VERIFY_HPP
@@ -0,0 +1,169 @@
+#ifndef TM_WAIT_HPP
+#define TM_WAIT_HPP 1
+
+#include <stdint.h>
+#include <limits.h>
+#include <atomic>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "rand_r_32.h"
+
+/**
+ *  Adaptive waiting for the engines and the test barrier.
+ *
+ *  A waiter calls tm_wait() once per failed check of its condition. The
+ *  first rounds spin with pause, the next ones back off exponentially,
+ *  then the thread yields, and after that it parks in the kernel on the
+ *  32-bit word it is watching (a ring entry, a stripe lock, a barrier
+ *  counter) until the word changes or a short timeout expires.
+ *
+ *  Whoever changes a watched word calls tm_wake() on it. That only costs a
+ *  load unless somebody is parked. The timeout bounds the rare case where
+ *  the store and the parked check race, so a missed wake-up delays a
+ *  waiter by at most WAIT_PARK_NSEC.
+ *
+ *  Waits that nobody wakes (a lock word without tm_wake(), a turn, a
+ *  reply slot) go through tm_poll() instead: WAIT_POLL_SPINS pauses, then
+ *  a yield per poll, since the thread we wait for may need our cpu.
+ *  tm_poll_timed() gives up after a timeout, which lock-based engines
+ *  take as a deadlock, and tm_backoff() is the randomized pause after
+ *  such an abort.
+ */
+
+#ifndef FORCE_INLINE
+#define FORCE_INLINE __attribute__((always_inline)) inline
+#endif
+
+#define WAIT_SPIN_ROUNDS	16		/* rounds of 64 pauses */
+#define WAIT_BACKOFF_ROUNDS	8		/* then 128, 256, ... pauses */
+#define WAIT_YIELD_ROUNDS	8		/* then sched_yield() */
+#define WAIT_PARK_NSEC		1000000		/* then futex park, 1ms max */
+#define WAIT_POLL_SPINS		64		/* polls before tm_poll() yields */
+#define WAIT_BACKOFF_MAX	64		/* yields after repeated aborts */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()	__builtin_ia32_pause()
+#else
+#define cpu_relax()	__asm__ volatile ("":::"memory")
+#endif
+
+struct tm_waiter
+{
+	unsigned int round;
+};
+
+struct tm_poller
+{
+	unsigned int spins;
+	unsigned long long deadline;			/* 0 until the first yield */
+};
+
+/* Number of threads parked in tm_wait(), shared by every translation unit */
+inline std::atomic<int>& tm_parked()
+{
+	static std::atomic<int> parked(0);
+	return parked;
+}
+
+FORCE_INLINE void tm_wait_reset(tm_waiter *w)
+{
+	w->round = 0;
+}
+
+/* Waits a little longer for the word at addr to stop holding val. Only the
+   low 32 bits of wider words are watched. */
+FORCE_INLINE void tm_wait(tm_waiter *w, const volatile void *addr, uint32_t val)
+{
+	unsigned int round = w->round++;
+
+	if (round < WAIT_SPIN_ROUNDS) {
+		for (int i = 0; i < 64; i++)
+			cpu_relax();
+		return;
+	}
+
+	round -= WAIT_SPIN_ROUNDS;
+	if (round < WAIT_BACKOFF_ROUNDS) {
+		for (int i = 0; i < (128 << round); i++)
+			cpu_relax();
+		return;
+	}
+
+	round -= WAIT_BACKOFF_ROUNDS;
+	if (round < WAIT_YIELD_ROUNDS) {
+		sched_yield();
+		return;
+	}
+
+	struct timespec timeout = { 0, WAIT_PARK_NSEC };
+
+	tm_parked().fetch_add(1, std::memory_order_seq_cst);
+	if (*(const volatile uint32_t *)addr == val)
+		syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, &timeout, NULL, 0);
+	tm_parked().fetch_sub(1, std::memory_order_relaxed);
+}
+
+/* Called after changing a word other threads may be waiting on */
+FORCE_INLINE void tm_wake(const volatile void *addr)
+{
+	if (__builtin_expect(tm_parked().load(std::memory_order_relaxed) != 0, false))
+		syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+FORCE_INLINE void tm_poll_reset(tm_poller *p)
+{
+	p->spins = 0;
+	p->deadline = 0;
+}
+
+/* One failed poll: pause for the first spins, then yield */
+FORCE_INLINE void tm_poll(tm_poller *p, unsigned int spins = WAIT_POLL_SPINS)
+{
+	if (p->spins < spins) {
+		p->spins++;
+		cpu_relax();
+	} else {
+		sched_yield();
+	}
+}
+
+inline unsigned long long tm_wait_now()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &time);
+
+	return time.tv_sec * 1000000000L + time.tv_nsec;
+}
+
+/* tm_poll(), but false once timeout_ns have passed since the first yield */
+FORCE_INLINE bool tm_poll_timed(tm_poller *p, unsigned long long timeout_ns)
+{
+	if (p->spins < WAIT_POLL_SPINS) {
+		p->spins++;
+		cpu_relax();
+		return true;
+	}
+	if (!p->deadline)
+		p->deadline = tm_wait_now() + timeout_ns;
+	else if (tm_wait_now() > p->deadline)
+		return false;
+	sched_yield();
+	return true;
+}
+
+/* After an abort: yield a random number of times, up to twice as many as
+   last time, so the transactions we collided with get ahead. The caller
+   zeroes *backoff on commit. */
+inline void tm_backoff(int *backoff, unsigned int *seed)
+{
+	*backoff = *backoff ? *backoff * 2 : 1;
+	if (*backoff > WAIT_BACKOFF_MAX)
+		*backoff = WAIT_BACKOFF_MAX;
+	for (int i = rand_r_32(seed) % (*backoff + 1); i > 0; i--)
+		sched_yield();
+}
+
+#endif //TM_WAIT_HPP